@@ -0,0 +1,346 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "FSCACHE1"
+#define CACHE_SLOT_COUNT 1024
+#define CACHE_PROBES 8
+
+// The data area is a ring that entries are appended to. Positions count
+// every byte ever appended, so an entry is intact as long as the head has not
+// moved a whole capacity past its start.
+typedef struct {
+    char magic[8];
+    uint64_t capacity;
+    uint64_t head;
+    uint32_t slot_count;
+    uint32_t reserved;
+} CacheHeader;
+
+// An entry is its key followed by its output. Empty slots have hash 0.
+typedef struct {
+    uint64_t hash;
+    uint64_t position;
+    uint64_t key_size;
+    uint64_t output_size;
+} CacheSlot;
+
+struct ResultCache {
+    int fd;
+    char *map;
+    size_t map_size;
+    CacheHeader *header;
+    CacheSlot *slots;
+    char *data;
+};
+
+void cache_key_add(CacheKey *key, const void *data, size_t size) {
+    if (key->size + size > key->capacity) {
+        key->capacity = key->capacity ? key->capacity * 2 : 4096;
+        if (key->capacity < key->size + size) key->capacity = key->size + size;
+        key->data = realloc(key->data, key->capacity);
+    }
+    memcpy(key->data + key->size, data, size);
+    key->size += size;
+}
+
+int cache_key_add_file(CacheKey *key, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+
+    int64_t fingerprint[] = {
+        (int64_t)st.st_dev,          (int64_t)st.st_ino,
+        (int64_t)st.st_size,         (int64_t)st.st_mtim.tv_sec,
+        (int64_t)st.st_mtim.tv_nsec, (int64_t)st.st_ctim.tv_sec,
+        (int64_t)st.st_ctim.tv_nsec,
+    };
+    cache_key_add(key, path, strlen(path) + 1);
+    cache_key_add(key, fingerprint, sizeof(fingerprint));
+    return 1;
+}
+
+void cache_key_free(CacheKey *key) {
+    free(key->data);
+    memset(key, 0, sizeof(*key));
+}
+
+static uint64_t hash_key(const CacheKey *key) {
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < key->size; i++) {
+        hash = (hash ^ (unsigned char)key->data[i]) * 1099511628211u;
+    }
+    return hash ? hash : 1;
+}
+
+static size_t cache_map_size(size_t capacity) {
+    return sizeof(CacheHeader) + CACHE_SLOT_COUNT * sizeof(CacheSlot) +
+           capacity;
+}
+
+// Other processes may have the file mapped, and touching a mapping past the
+// end of a shrunken file raises SIGBUS, so a cache file is only ever sized
+// while it is still empty. Its size never changes afterwards.
+ResultCache *result_cache_open(const char *path, size_t size) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open cache: %s\n", path);
+        return NULL;
+    }
+    flock(fd, LOCK_EX);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Cannot open cache: %s\n", path);
+        flock(fd, LOCK_UN);
+        close(fd);
+        return NULL;
+    }
+
+    CacheHeader header;
+    int fresh = st.st_size == 0;
+    if (fresh) {
+        if (ftruncate(fd, cache_map_size(size)) != 0) {
+            fprintf(stderr, "Cannot size cache: %s\n", path);
+            flock(fd, LOCK_UN);
+            close(fd);
+            return NULL;
+        }
+    } else if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+               memcmp(header.magic, CACHE_MAGIC, 8) != 0 ||
+               header.slot_count != CACHE_SLOT_COUNT ||
+               header.capacity == 0 ||
+               (uint64_t)st.st_size != cache_map_size(header.capacity)) {
+        fprintf(stderr, "Not a cache file, skipping the cache: %s\n", path);
+        flock(fd, LOCK_UN);
+        close(fd);
+        return NULL;
+    } else {
+        size = header.capacity;
+    }
+
+    size_t map_size = cache_map_size(size);
+    char *map =
+        mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map cache: %s\n", path);
+        flock(fd, LOCK_UN);
+        close(fd);
+        return NULL;
+    }
+
+    ResultCache *cache = malloc(sizeof(ResultCache));
+    cache->fd = fd;
+    cache->map = map;
+    cache->map_size = map_size;
+    cache->header = (CacheHeader *)map;
+    cache->slots = (CacheSlot *)(map + sizeof(CacheHeader));
+    cache->data = map + sizeof(CacheHeader) +
+                  CACHE_SLOT_COUNT * sizeof(CacheSlot);
+
+    if (fresh) {
+        cache->header->capacity = size;
+        cache->header->head = 0;
+        cache->header->slot_count = CACHE_SLOT_COUNT;
+        memcpy(cache->header->magic, CACHE_MAGIC, 8);
+    }
+    flock(fd, LOCK_UN);
+    return cache;
+}
+
+void result_cache_close(ResultCache *cache) {
+    if (!cache) return;
+    munmap(cache->map, cache->map_size);
+    close(cache->fd);
+    free(cache);
+}
+
+size_t result_cache_room(const ResultCache *cache, const CacheKey *key) {
+    uint64_t capacity = cache->header->capacity;
+    return key->size < capacity ? capacity - key->size : 0;
+}
+
+static int slot_is_live(const ResultCache *cache, const CacheSlot *slot) {
+    return slot->hash != 0 &&
+           cache->header->head <= slot->position + cache->header->capacity;
+}
+
+static CacheSlot *find_slot(ResultCache *cache, const CacheKey *key,
+                            uint64_t hash) {
+    for (int i = 0; i < CACHE_PROBES; i++) {
+        CacheSlot *slot = &cache->slots[(hash + i) % CACHE_SLOT_COUNT];
+        if (slot->hash == hash && slot_is_live(cache, slot) &&
+            slot->key_size == key->size &&
+            memcmp(cache->data + slot->position % cache->header->capacity,
+                   key->data, key->size) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+int result_cache_replay(ResultCache *cache, const CacheKey *key, int fd) {
+    uint64_t hash = hash_key(key);
+    flock(cache->fd, LOCK_SH);
+
+    CacheSlot *slot = find_slot(cache, key, hash);
+    int ok = slot != NULL;
+    if (ok) {
+        const char *output = cache->data +
+                             slot->position % cache->header->capacity +
+                             slot->key_size;
+        size_t left = slot->output_size;
+        while (left > 0) {
+            ssize_t written = write(fd, output, left);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            output += written;
+            left -= written;
+        }
+    }
+
+    flock(cache->fd, LOCK_UN);
+    return ok;
+}
+
+// Entries never straddle the end of the data area; one that would is
+// started at the beginning instead.
+void result_cache_store(ResultCache *cache, const CacheKey *key,
+                        const char *output, size_t size) {
+    uint64_t hash = hash_key(key);
+    flock(cache->fd, LOCK_EX);
+
+    CacheHeader *header = cache->header;
+    uint64_t length = key->size + size;
+    if (length > header->capacity || find_slot(cache, key, hash)) {
+        flock(cache->fd, LOCK_UN);
+        return;
+    }
+
+    uint64_t offset = header->head % header->capacity;
+    if (offset + length > header->capacity) {
+        header->head += header->capacity - offset;
+        offset = 0;
+    }
+    uint64_t position = header->head;
+    memcpy(cache->data + offset, key->data, key->size);
+    memcpy(cache->data + offset + key->size, output, size);
+    header->head += length;
+
+    // Reuse an empty or overwritten slot near the hash, or else the one with
+    // the oldest entry.
+    CacheSlot *victim = NULL;
+    for (int i = 0; i < CACHE_PROBES; i++) {
+        CacheSlot *slot = &cache->slots[(hash + i) % CACHE_SLOT_COUNT];
+        if (!slot_is_live(cache, slot)) {
+            victim = slot;
+            break;
+        }
+        if (!victim || slot->position < victim->position) victim = slot;
+    }
+    victim->hash = hash;
+    victim->position = position;
+    victim->key_size = key->size;
+    victim->output_size = size;
+
+    flock(cache->fd, LOCK_UN);
+}
+
+struct OutputCapture {
+    int saved_fd;
+    int pipe_fd;
+    pthread_t thread;
+    char *data;
+    size_t size;
+    size_t capacity;
+    size_t limit;
+    int overflowed;
+};
+
+// Passes everything from the pipe on to the real stdout, keeping a copy.
+static void *capture_main(void *arg) {
+    OutputCapture *capture = arg;
+    char buffer[64 * 1024];
+
+    for (;;) {
+        ssize_t bytes_read = read(capture->pipe_fd, buffer, sizeof(buffer));
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read <= 0) break;
+
+        for (ssize_t done = 0; done < bytes_read;) {
+            ssize_t written =
+                write(capture->saved_fd, buffer + done, bytes_read - done);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            done += written;
+        }
+
+        if (capture->overflowed) continue;
+        if (capture->size + bytes_read > capture->limit) {
+            capture->overflowed = 1;
+            free(capture->data);
+            capture->data = NULL;
+            continue;
+        }
+        if (capture->size + bytes_read > capture->capacity) {
+            capture->capacity = capture->capacity ? capture->capacity * 2
+                                                  : sizeof(buffer);
+            if (capture->capacity < capture->size + bytes_read) {
+                capture->capacity = capture->size + bytes_read;
+            }
+            capture->data = realloc(capture->data, capture->capacity);
+        }
+        memcpy(capture->data + capture->size, buffer, bytes_read);
+        capture->size += bytes_read;
+    }
+    return NULL;
+}
+
+OutputCapture *output_capture_start(size_t limit) {
+    int fds[2];
+    fflush(stdout);
+    if (pipe(fds) != 0) return NULL;
+
+    OutputCapture *capture = calloc(1, sizeof(OutputCapture));
+    capture->limit = limit;
+    capture->pipe_fd = fds[0];
+    capture->saved_fd = dup(STDOUT_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+    pthread_create(&capture->thread, NULL, capture_main, capture);
+    return capture;
+}
+
+char *output_capture_finish(OutputCapture *capture, size_t *size) {
+    if (!capture) return NULL;
+
+    // Putting the real stdout back closes the last write end of the pipe,
+    // which ends the thread once it has passed everything on.
+    fflush(stdout);
+    dup2(capture->saved_fd, STDOUT_FILENO);
+    pthread_join(capture->thread, NULL);
+    close(capture->saved_fd);
+    close(capture->pipe_fd);
+
+    char *data = capture->overflowed ? NULL : capture->data;
+    if (data && capture->size == 0) data = malloc(1);
+    *size = capture->size;
+    free(capture);
+    return data;
+}
@@ -0,0 +1,58 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+// Results of earlier runs, kept in one memory-mapped file of fixed size. An
+// entry is the output of a run stored under a key that fingerprints all of
+// its inputs: the size, modification and change times and inode of every
+// file, and the options that shape the output. A changed input makes a
+// different key, so stale entries are never hit; they are overwritten as
+// newer entries wrap around the data area, oldest first.
+//
+// Processes share the file under flock, so concurrent runs may use one cache.
+
+typedef struct ResultCache ResultCache;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} CacheKey;
+
+void cache_key_add(CacheKey *key, const void *data, size_t size);
+
+// Adds the path and fingerprint of a file. Returns 0 for anything that is not
+// a regular file, such as a pipe, which cannot be fingerprinted.
+int cache_key_add_file(CacheKey *key, const char *path);
+
+void cache_key_free(CacheKey *key);
+
+// Opens a cache, or creates one whose data area holds `size` bytes. An
+// existing cache keeps the size it was created with. Returns NULL, after
+// printing why, if the file cannot be opened or mapped or is not a cache.
+ResultCache *result_cache_open(const char *path, size_t size);
+void result_cache_close(ResultCache *cache);
+
+// Largest output that fits next to `key`, or 0 if nothing does.
+size_t result_cache_room(const ResultCache *cache, const CacheKey *key);
+
+// Writes the output stored under `key` to `fd` and returns 1, or returns 0
+// if there is none.
+int result_cache_replay(ResultCache *cache, const CacheKey *key, int fd);
+
+void result_cache_store(ResultCache *cache, const CacheKey *key,
+                        const char *output, size_t size);
+
+// Copies everything written to stdout, through stdio or straight to the file
+// descriptor, into memory while still passing it through, so a miss prints
+// its output as it is produced. Keeps at most `limit` bytes.
+typedef struct OutputCapture OutputCapture;
+
+OutputCapture *output_capture_start(size_t limit);
+
+// Restores stdout. Returns the output, to be freed by the caller, or NULL if
+// it was over the limit.
+char *output_capture_finish(OutputCapture *capture, size_t *size);
+
+#endif  // CACHE_H
@@ -1,433 +1,1108 @@
-#include <ctype.h>
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "discovery.h"
+#include "freeslots.h"
+#include "loader.h"
+#include "pipeline.h"
+#include "report.h"
+#include "stats.h"
+#include "trace.h"
 
-#define MAX_EVENTS 1000
-#define MAX_LINE_LENGTH 1024
 #define MAX_FIELD_LENGTH 32
 
+typedef FreeSlotsDate Date;
+typedef FreeSlotsConfig Config;
+
 typedef struct {
-    int year;
-    int month;
-    int day;
-} Date;
+    char **ids;
+    FreeSlotsQuery *queries;
+    int count;
+    int capacity;
+    int calendar_count;
+    long slot_count;
+} QueryBatch;
 
 typedef struct {
-    Date date;
-    int start_minutes;
-    int end_minutes;
-} Event;
+    char **paths;
+    int count;
+    int capacity;
+    int *buckets;
+    int bucket_count;
+} CalendarPaths;
 
 typedef struct {
-    Event *events;
+    char *name;
+    int *calendars;
     int count;
     int capacity;
-} EventList;
+    char *output;
+    size_t output_size;
+} Group;
 
 typedef struct {
-    int window_start_minutes;
-    int window_end_minutes;
-    int minimum_slot_minutes;
-} Config;
+    Group *groups;
+    int count;
+    int capacity;
+} Manifest;
 
-EventList *create_event_list() {
-    EventList *list = malloc(sizeof(EventList));
-    list->events = malloc(sizeof(Event) * 10);
-    list->count = 0;
-    list->capacity = 10;
-    return list;
+typedef struct {
+    FILE *log;
+    Stats *stats;
+} SkipLog;
+
+void print_skipped_line(int line_number, const char *reason,
+                        const char *field, void *user_data) {
+    SkipLog *skip_log = user_data;
+
+    stats_count_skip(skip_log->stats, reason);
+    if (field) {
+        fprintf(skip_log->log, "Skipping line %d: %s '%s'\n", line_number,
+                reason, field);
+    } else {
+        fprintf(skip_log->log, "Skipping line %d: %s\n", line_number, reason);
+    }
 }
 
-void add_event(EventList *list, Event event) {
-    if (list->count >= list->capacity) {
-        list->capacity *= 2;
-        list->events = realloc(list->events, sizeof(Event) * list->capacity);
+typedef struct {
+    const char *path;
+    FreeSlotsStore *store;
+    int calendar;
+    char *log;
+    size_t log_size;
+    Stats stats;
+    int ok;
+} LoadTask;
+
+void parse_calendar_file(LoadedFile *file, void *user_data) {
+    LoadTask *task = file->context;
+    (void)user_data;
+    if (task->stats.enabled) {
+        task->stats.phase_seconds[STATS_PHASE_READ] += file->read_seconds;
     }
-    list->events[list->count] = event;
-    list->count++;
+    if (!file->data) return;
+
+    trace_begin("parse file", task->path);
+    FILE *log = open_memstream(&task->log, &task->log_size);
+    task->stats.bytes_read += file->size;
+
+    double started = stats_begin_phase(&task->stats, STATS_PHASE_PARSE);
+    SkipLog skip_log = {log, &task->stats};
+    task->ok = freeslots_store_add_csv(task->store, task->calendar, file->data,
+                                       file->size, print_skipped_line,
+                                       &skip_log);
+    stats_end_phase(&task->stats, STATS_PHASE_PARSE, started);
+    trace_end("bytes", file->size);
+
+    fclose(log);
+    free(file->data);
 }
 
-void free_event_list(EventList *list) {
-    free(list->events);
-    free(list);
-}
+// Hands out the files for the loader, from the discovery thread or from a
+// list, and gives each the next calendar of the store.
+typedef struct {
+    FreeSlotsStore *store;
+    FreeSlotsPool *pool;
+    Stats *stats;
+    Discovery *discovery;
+    char *const *paths;
+    int path_count;
+    LoadTask **tasks;
+    int count;
+    int capacity;
+} CalendarLoader;
+
+int next_calendar_file(void *user_data, int wait, const char **path,
+                       void **context) {
+    CalendarLoader *loader = user_data;
+    if (loader->discovery) {
+        int got = discovery_next(loader->discovery, wait, path);
+        if (got <= 0) return got;
+    } else {
+        if (loader->count >= loader->path_count) return -1;
+        *path = loader->paths[loader->count];
+    }
 
-int is_leap_year(int year) {
-    return (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
-}
+    if (loader->count >= loader->capacity) {
+        loader->capacity = loader->capacity ? loader->capacity * 2 : 64;
+        loader->tasks =
+            realloc(loader->tasks, sizeof(LoadTask *) * loader->capacity);
+    }
 
-int days_in_month(int year, int month) {
-    int days_per_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    LoadTask *task = calloc(1, sizeof(LoadTask));
+    task->path = *path;
+    task->store = loader->store;
+    task->calendar = freeslots_store_add_calendar(loader->store);
+    task->stats.enabled = loader->stats->enabled;
+    task->stats.perf = loader->pool ? NULL : loader->stats->perf;
+    loader->tasks[loader->count++] = task;
+    *context = task;
+    return 1;
+}
 
-    if (month == 2 && is_leap_year(year)) {
-        return 29;
+// Loads one calendar per file. The loader reads the files in batches and
+// parses each on the pool as soon as it is read. Each file's diagnostics are
+// buffered and printed in file order so the output does not depend on which
+// file finished first.
+int load_calendars(CalendarLoader *loader, LoaderBackend backend) {
+    Stats *stats = loader->stats;
+    double started = stats_begin_phase(stats, STATS_PHASE_LOAD);
+    stats->loader = load_files(next_calendar_file, parse_calendar_file,
+                               loader, backend, loader->pool);
+    stats_end_phase(stats, STATS_PHASE_LOAD, started);
+
+    int ok = 1;
+    if (!stats->loader) {
+        fprintf(stderr, "Error: This kernel does not support io_uring\n");
+        ok = 0;
     }
-    return days_per_month[month - 1];
-}
 
-int compare_dates(Date date1, Date date2) {
-    if (date1.year != date2.year) {
-        return date1.year - date2.year;
+    for (int i = 0; i < loader->count; i++) {
+        LoadTask *task = loader->tasks[i];
+        stats_merge(stats, &task->stats);
+        if (ok) {
+            printf("Loading events from: %s\n", task->path);
+            if (task->log) {
+                fwrite(task->log, 1, task->log_size, stdout);
+            }
+            if (!task->ok) {
+                fprintf(stderr, "Error loading file: %s\n", task->path);
+                ok = 0;
+            }
+        }
+        free(task->log);
+        free(task);
     }
-    if (date1.month != date2.month) {
-        return date1.month - date2.month;
+    free(loader->tasks);
+
+    if (ok && stats->enabled) {
+        stats->events = freeslots_store_event_count(loader->store);
+        stats->rows_read =
+            freeslots_store_row_count(loader->store) + stats->rows_skipped;
     }
-    return date1.day - date2.day;
+    return ok;
 }
 
-Date add_days_to_date(Date date, int days) {
-    Date result = date;
-    result.day += days;
-
-    while (result.day > days_in_month(result.year, result.month)) {
-        result.day -= days_in_month(result.year, result.month);
-        result.month++;
+int load_calendar_files(FreeSlotsStore *store, char *const *paths, int count,
+                        LoaderBackend backend, FreeSlotsPool *pool,
+                        Stats *stats) {
+    CalendarLoader loader = {.store = store, .pool = pool, .stats = stats,
+                             .paths = paths, .path_count = count};
+    return load_calendars(&loader, backend);
+}
 
-        if (result.month > 12) {
-            result.month = 1;
-            result.year++;
-        }
+// Like load_calendar_files, but for command-line inputs, which may also be
+// directories and glob patterns. Files are read while later ones are still
+// being found.
+int load_calendar_inputs(FreeSlotsStore *store, char *const *inputs,
+                         int count, LoaderBackend backend,
+                         FreeSlotsPool *pool, Stats *stats) {
+    CalendarLoader loader = {.store = store, .pool = pool, .stats = stats};
+    loader.discovery = discovery_start(inputs, count);
+
+    int ok = load_calendars(&loader, backend);
+    if (!discovery_finish(loader.discovery)) ok = 0;
+    if (ok && freeslots_store_calendar_count(store) == 0) {
+        fprintf(stderr, "Error: No CSV files found\n");
+        ok = 0;
     }
+    discovery_destroy(loader.discovery);
+    return ok;
+}
 
-    while (result.day < 1) {
-        result.month--;
-        if (result.month < 1) {
-            result.month = 12;
-            result.year--;
-        }
-        result.day += days_in_month(result.year, result.month);
-    }
+void write_time_slot(FILE *out, Date date, int start_minutes,
+                     int end_minutes) {
+    int start_hours = start_minutes / 60;
+    int start_mins = start_minutes % 60;
+    int end_hours = end_minutes / 60;
+    int end_mins = end_minutes % 60;
+    int duration = end_minutes - start_minutes;
 
-    return result;
+    fprintf(out, "%04d-%02d-%02d   %02d:%02d   %02d:%02d   %d\n", date.year,
+            date.month, date.day, start_hours, start_mins, end_hours,
+            end_mins, duration);
 }
 
-int parse_time_to_minutes(const char *time_str) {
-    if (strlen(time_str) != 5 || time_str[2] != ':') {
-        return -1;
-    }
+void print_time_slot(Date date, int start_minutes, int end_minutes) {
+    write_time_slot(stdout, date, start_minutes, end_minutes);
+}
 
-    if (!isdigit(time_str[0]) || !isdigit(time_str[1]) ||
-        !isdigit(time_str[3]) || !isdigit(time_str[4])) {
-        return -1;
-    }
+// Where print_slot writes the slots, counts them and, with --report, adds
+// them up.
+typedef struct {
+    FILE *out;
+    Stats *stats;
+    Report *report;
+} SlotSink;
+
+void print_slot(const FreeSlotsSlot *slot, void *user_data) {
+    SlotSink *sink = user_data;
+    sink->stats->slots++;
+    if (sink->report) report_add_slot(sink->report, slot);
+    write_time_slot(sink->out, slot->date, slot->start_minutes,
+                    slot->end_minutes);
+}
 
-    int hours = (time_str[0] - '0') * 10 + (time_str[1] - '0');
-    int minutes = (time_str[3] - '0') * 10 + (time_str[4] - '0');
+void report_slot_day(int query, Date date, void *user_data) {
+    (void)query;
+    SlotSink *sink = user_data;
+    report_add_day(sink->report, date);
+}
 
-    if (hours > 24 || minutes > 59 || (hours == 24 && minutes != 0)) {
-        return -1;
-    }
+void print_query_slot(const FreeSlotsSlot *slot, void *user_data) {
+    QueryBatch *batch = user_data;
+    batch->slot_count++;
+    printf("%-12s ", batch->ids[slot->query]);
+    print_time_slot(slot->date, slot->start_minutes, slot->end_minutes);
+}
 
-    return hours * 60 + minutes;
+void write_slot(const FreeSlotsSlot *slot, void *user_data) {
+    write_time_slot(user_data, slot->date, slot->start_minutes,
+                    slot->end_minutes);
 }
 
-int parse_date(const char *date_str, Date *date) {
-    if (strlen(date_str) != 10 || date_str[4] != '-' || date_str[7] != '-') {
+int parse_window_argument(const char *arg, int *start_minutes,
+                          int *end_minutes) {
+    const char *dash = strchr(arg, '-');
+    if (!dash) {
         return 0;
     }
 
-    char year_str[5] = {date_str[0], date_str[1], date_str[2], date_str[3], 0};
-    char month_str[3] = {date_str[5], date_str[6], 0};
-    char day_str[3] = {date_str[8], date_str[9], 0};
-
-    date->year = atoi(year_str);
-    date->month = atoi(month_str);
-    date->day = atoi(day_str);
+    char start_str[6] = {0};
+    char end_str[6] = {0};
 
-    if (date->month < 1 || date->month > 12 || date->day < 1 ||
-        date->day > 31) {
+    int start_len = dash - arg;
+    if (start_len != 5) {
         return 0;
     }
 
-    return 1;
-}
+    if (strlen(dash + 1) != 5) {
+        return 0;
+    }
 
-int parse_csv_line(const char *line, char fields[][MAX_FIELD_LENGTH],
-                   int max_fields) {
-    int field_count = 0;
-    int field_pos = 0;
-    int line_pos = 0;
+    strncpy(start_str, arg, 5);
+    strcpy(end_str, dash + 1);
 
-    while (line[line_pos] && field_count < max_fields) {
-        char c = line[line_pos];
+    *start_minutes = freeslots_parse_time(start_str);
+    *end_minutes = freeslots_parse_time(end_str);
 
-        if (c == ',' || c == '\n' || c == '\r' || c == '\0') {
-            fields[field_count][field_pos] = '\0';
-            field_count++;
-            field_pos = 0;
+    return (*start_minutes >= 0 && *end_minutes >= 0 &&
+            *start_minutes <= *end_minutes);
+}
 
-            if (c == '\r' && line[line_pos + 1] == '\n') {
-                line_pos++;
-            }
+int parse_date_range(const char *arg, Date *from, Date *to) {
+    if (strcmp(arg, "*") == 0) {
+        *from = (Date){0};
+        *to = (Date){0};
+        return 1;
+    }
 
-            if (c == '\n' || c == '\r') {
-                break;
-            }
-        } else {
-            if (field_pos < MAX_FIELD_LENGTH - 1) {
-                fields[field_count][field_pos] = c;
-                field_pos++;
-            }
-        }
-        line_pos++;
+    const char *dots = strstr(arg, "..");
+    if (!dots) {
+        if (!freeslots_parse_date(arg, from)) return 0;
+        *to = *from;
+        return 1;
     }
 
-    if (field_pos > 0 && field_count < max_fields) {
-        fields[field_count][field_pos] = '\0';
-        field_count++;
+    char from_str[MAX_FIELD_LENGTH] = {0};
+    int from_len = dots - arg;
+    if (from_len >= MAX_FIELD_LENGTH) {
+        return 0;
     }
+    strncpy(from_str, arg, from_len);
 
-    return field_count;
+    return freeslots_parse_date(from_str, from) &&
+           freeslots_parse_date(dots + 2, to) &&
+           freeslots_compare_dates(*from, *to) <= 0;
 }
 
-void process_multi_day_event(EventList *event_list, Date start_date,
-                             Date end_date, int start_minutes,
-                             int end_minutes) {
-    Date current_date = start_date;
-
-    while (compare_dates(current_date, end_date) <= 0) {
-        Event daily_event;
-        daily_event.date = current_date;
+int *parse_calendar_subset(const char *arg, int calendar_count, int *count) {
+    *count = 0;
+    if (strcmp(arg, "*") == 0) {
+        return NULL;
+    }
 
-        if (compare_dates(current_date, start_date) == 0) {
-            daily_event.start_minutes = start_minutes;
-        } else {
-            daily_event.start_minutes = 0;
+    int *calendars = NULL;
+    int capacity = 0;
+
+    const char *cursor = arg;
+    while (*cursor) {
+        char *end;
+        long index = strtol(cursor, &end, 10);
+        if (end == cursor || index < 1 || index > calendar_count) {
+            free(calendars);
+            *count = -1;
+            return NULL;
         }
 
-        if (compare_dates(current_date, end_date) == 0) {
-            daily_event.end_minutes = end_minutes;
-        } else {
-            daily_event.end_minutes = 24 * 60;
+        if (*count >= capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            calendars = realloc(calendars, sizeof(int) * capacity);
         }
-
-        if (daily_event.end_minutes > daily_event.start_minutes) {
-            add_event(event_list, daily_event);
+        calendars[(*count)++] = index - 1;
+
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            free(calendars);
+            *count = -1;
+            return NULL;
         }
+        cursor = end;
+    }
+
+    return calendars;
+}
 
-        current_date = add_days_to_date(current_date, 1);
+void add_query(QueryBatch *batch, const char *id, FreeSlotsQuery query) {
+    if (batch->count >= batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 16;
+        batch->ids = realloc(batch->ids, sizeof(*batch->ids) * batch->capacity);
+        batch->queries =
+            realloc(batch->queries, sizeof(FreeSlotsQuery) * batch->capacity);
     }
+    batch->ids[batch->count] = strdup(id);
+    batch->queries[batch->count] = query;
+    batch->count++;
 }
 
-int load_events_from_csv(const char *filename, EventList *event_list) {
+void free_query_batch(QueryBatch *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        free((int *)batch->queries[i].calendars);
+        free(batch->ids[i]);
+    }
+    free(batch->ids);
+    free(batch->queries);
+}
+
+// Lines are read whole and split on whitespace in place, so no field is ever
+// cut short. Lines that cannot be used are reported on stderr and skipped.
+int load_queries_from_file(const char *filename, QueryBatch *batch) {
     FILE *file = fopen(filename, "r");
     if (!file) {
         fprintf(stderr, "Cannot open file: %s\n", filename);
         return 0;
     }
 
-    char line[MAX_LINE_LENGTH];
+    char *line = NULL;
+    size_t line_capacity = 0;
     int line_number = 0;
 
-    while (fgets(line, sizeof(line), file)) {
+    while (getline(&line, &line_capacity, file) != -1) {
         line_number++;
 
-        char fields[4][MAX_FIELD_LENGTH];
-        int field_count = parse_csv_line(line, fields, 4);
+        char *fields[5] = {0};
+        int field_count = 0;
+        char *extra = NULL;
+        for (char *field = strtok(line, " \t\r\n"); field;
+             field = strtok(NULL, " \t\r\n")) {
+            if (field_count == 5) {
+                extra = field;
+                break;
+            }
+            fields[field_count++] = field;
+        }
 
-        if (field_count < 4) {
-            printf("Skipping line %d: insufficient fields\n", line_number);
+        if (field_count == 0 || fields[0][0] == '#') {
             continue;
         }
 
-        Date start_date, end_date;
-        if (!parse_date(fields[0], &start_date)) {
-            printf("Skipping line %d: invalid start date '%s'\n", line_number,
-                   fields[0]);
+        if (field_count < 3) {
+            fprintf(stderr, "Skipping query line %d: insufficient fields\n",
+                    line_number);
             continue;
         }
 
-        if (!parse_date(fields[2], &end_date)) {
-            printf("Skipping line %d: invalid end date '%s'\n", line_number,
-                   fields[2]);
+        if (extra) {
+            fprintf(stderr, "Skipping query line %d: unexpected field '%s'\n",
+                    line_number, extra);
             continue;
         }
 
-        int start_minutes = parse_time_to_minutes(fields[1]);
-        int end_minutes = parse_time_to_minutes(fields[3]);
+        FreeSlotsQuery query = {0};
 
-        if (start_minutes < 0) {
-            printf("Skipping line %d: invalid start time '%s'\n", line_number,
-                   fields[1]);
+        if (!parse_window_argument(fields[1],
+                                   &query.config.window_start_minutes,
+                                   &query.config.window_end_minutes)) {
+            fprintf(stderr, "Skipping query line %d: invalid window '%s'\n",
+                    line_number, fields[1]);
             continue;
         }
 
-        if (end_minutes < 0) {
-            printf("Skipping line %d: invalid end time '%s'\n", line_number,
-                   fields[3]);
+        char *end;
+        long minimum = strtol(fields[2], &end, 10);
+        if (end == fields[2] || *end != '\0' || minimum > INT_MAX) {
+            fprintf(stderr, "Skipping query line %d: invalid minimum '%s'\n",
+                    line_number, fields[2]);
             continue;
         }
+        query.config.minimum_slot_minutes = minimum < 0 ? 0 : (int)minimum;
 
-        process_multi_day_event(event_list, start_date, end_date, start_minutes,
-                                end_minutes);
+        if (!parse_date_range(field_count > 3 ? fields[3] : "*", &query.from,
+                              &query.to)) {
+            fprintf(stderr,
+                    "Skipping query line %d: invalid date range '%s'\n",
+                    line_number, fields[3]);
+            continue;
+        }
+
+        query.calendars =
+            parse_calendar_subset(field_count > 4 ? fields[4] : "*",
+                                  batch->calendar_count, &query.calendar_count);
+        if (query.calendar_count < 0) {
+            fprintf(stderr, "Skipping query line %d: invalid calendars '%s'\n",
+                    line_number, fields[4]);
+            continue;
+        }
+
+        add_query(batch, fields[0], query);
     }
 
+    free(line);
     fclose(file);
     return 1;
 }
 
-int compare_events(const void *a, const void *b) {
-    const Event *event1 = (const Event *)a;
-    const Event *event2 = (const Event *)b;
+unsigned int hash_string(const char *str) {
+    unsigned int hash = 2166136261u;
+    while (*str) {
+        hash = (hash ^ (unsigned char)*str++) * 16777619u;
+    }
+    return hash;
+}
+
+int intern_calendar_path(CalendarPaths *paths, const char *path) {
+    if (paths->count * 2 >= paths->bucket_count) {
+        int bucket_count = paths->bucket_count ? paths->bucket_count * 2 : 64;
+        int *buckets = malloc(sizeof(int) * bucket_count);
+        for (int i = 0; i < bucket_count; i++) buckets[i] = -1;
+
+        for (int i = 0; i < paths->count; i++) {
+            unsigned int slot = hash_string(paths->paths[i]);
+            while (buckets[slot % bucket_count] != -1) slot++;
+            buckets[slot % bucket_count] = i;
+        }
+
+        free(paths->buckets);
+        paths->buckets = buckets;
+        paths->bucket_count = bucket_count;
+    }
 
-    int date_comparison = compare_dates(event1->date, event2->date);
-    if (date_comparison != 0) {
-        return date_comparison;
+    unsigned int slot = hash_string(path);
+    while (paths->buckets[slot % paths->bucket_count] != -1) {
+        int index = paths->buckets[slot % paths->bucket_count];
+        if (strcmp(paths->paths[index], path) == 0) {
+            return index;
+        }
+        slot++;
     }
 
-    if (event1->start_minutes != event2->start_minutes) {
-        return event1->start_minutes - event2->start_minutes;
+    if (paths->count >= paths->capacity) {
+        paths->capacity = paths->capacity ? paths->capacity * 2 : 16;
+        paths->paths = realloc(paths->paths, sizeof(char *) * paths->capacity);
     }
 
-    return event1->end_minutes - event2->end_minutes;
+    paths->paths[paths->count] = strdup(path);
+    paths->buckets[slot % paths->bucket_count] = paths->count;
+    return paths->count++;
 }
 
-void merge_intervals_for_day(Event *day_events, int event_count,
-                             int window_start, int window_end,
-                             int *merged_starts, int *merged_ends,
-                             int *merged_count) {
-    *merged_count = 0;
+void free_calendar_paths(CalendarPaths *paths) {
+    for (int i = 0; i < paths->count; i++) {
+        free(paths->paths[i]);
+    }
+    free(paths->paths);
+    free(paths->buckets);
+}
 
-    if (event_count == 0) {
-        return;
+Group *find_or_add_group(Manifest *manifest, const char *name) {
+    for (int i = manifest->count - 1; i >= 0; i--) {
+        if (strcmp(manifest->groups[i].name, name) == 0) {
+            return &manifest->groups[i];
+        }
     }
 
-    int current_start = day_events[0].start_minutes;
-    int current_end = day_events[0].end_minutes;
+    if (manifest->count >= manifest->capacity) {
+        manifest->capacity = manifest->capacity ? manifest->capacity * 2 : 16;
+        manifest->groups =
+            realloc(manifest->groups, sizeof(Group) * manifest->capacity);
+    }
 
-    if (current_start < window_start) current_start = window_start;
-    if (current_end > window_end) current_end = window_end;
+    Group *group = &manifest->groups[manifest->count++];
+    memset(group, 0, sizeof(Group));
+    group->name = strdup(name);
+    return group;
+}
 
-    if (current_end <= window_start || current_start >= window_end) {
-        current_start = -1;
+void add_group_calendar(Group *group, int calendar) {
+    if (group->count >= group->capacity) {
+        group->capacity = group->capacity ? group->capacity * 2 : 4;
+        group->calendars =
+            realloc(group->calendars, sizeof(int) * group->capacity);
     }
+    group->calendars[group->count] = calendar;
+    group->count++;
+}
 
-    for (int i = 1; i < event_count; i++) {
-        int next_start = day_events[i].start_minutes;
-        int next_end = day_events[i].end_minutes;
+void free_manifest(Manifest *manifest) {
+    for (int i = 0; i < manifest->count; i++) {
+        free(manifest->groups[i].name);
+        free(manifest->groups[i].calendars);
+        free(manifest->groups[i].output);
+    }
+    free(manifest->groups);
+}
 
-        if (next_start < window_start) next_start = window_start;
-        if (next_end > window_end) next_end = window_end;
+int load_manifest(const char *filename, Manifest *manifest,
+                  CalendarPaths *paths) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot open file: %s\n", filename);
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    int line_number = 0;
+
+    while (getline(&line, &line_capacity, file) != -1) {
+        line_number++;
 
-        if (next_end <= window_start || next_start >= window_end) {
+        char *name = strtok(line, " \t\r\n");
+        if (!name || name[0] == '#') {
             continue;
         }
 
-        if (current_start == -1) {
-            current_start = next_start;
-            current_end = next_end;
-        } else if (next_start <= current_end) {
-            if (next_end > current_end) {
-                current_end = next_end;
-            }
+        char *path = strtok(NULL, " \t\r\n");
+        if (!path) {
+            fprintf(stderr, "Skipping manifest line %d: no calendar files\n",
+                    line_number);
+            continue;
+        }
+
+        Group *group = find_or_add_group(manifest, name);
+        for (; path; path = strtok(NULL, " \t\r\n")) {
+            add_group_calendar(group, intern_calendar_path(paths, path));
+        }
+    }
+
+    free(line);
+    fclose(file);
+    return 1;
+}
+
+typedef struct {
+    Group *group;
+    const FreeSlotsStore *store;
+    Config config;
+} GroupTask;
+
+void compute_group_task(void *arg) {
+    GroupTask *task = arg;
+    Group *group = task->group;
+    FreeSlotsQuery query = {.config = task->config,
+                            .calendars = group->calendars,
+                            .calendar_count = group->count};
+
+    trace_begin("group", group->name);
+    FILE *out = open_memstream(&group->output, &group->output_size);
+    freeslots_query(task->store, &query, write_slot, out);
+    fclose(out);
+    trace_end("bytes", group->output_size);
+}
+
+int run_manifest(const char *filename, Config config, LoaderBackend loader,
+                 FreeSlotsPool *pool, Stats *stats) {
+    Manifest manifest = {0};
+    CalendarPaths paths = {0};
+
+    if (!load_manifest(filename, &manifest, &paths)) {
+        return 0;
+    }
+
+    FreeSlotsStore *store = freeslots_store_create();
+    freeslots_store_set_isa(store, stats->isa);
+    if (trace_enabled()) {
+        freeslots_store_set_span_callback(store, trace_library_span, NULL);
+    }
+
+    if (!load_calendar_files(store, paths.paths, paths.count, loader, pool,
+                             stats)) {
+        freeslots_store_destroy(store);
+        free_manifest(&manifest);
+        free_calendar_paths(&paths);
+        return 0;
+    }
+
+    double started = stats_begin_phase(stats, STATS_PHASE_INDEX);
+    trace_begin("build index", NULL);
+    freeslots_store_build_index_parallel(store, pool);
+    trace_end("busy intervals", freeslots_store_busy_count(store));
+    stats_end_phase(stats, STATS_PHASE_INDEX, started);
+
+    printf("Loaded %ld events from %d calendars for %d groups\n",
+           freeslots_store_event_count(store), paths.count, manifest.count);
+    printf("Normalized to %ld busy intervals\n\n",
+           freeslots_store_busy_count(store));
+
+    GroupTask *tasks = malloc(sizeof(GroupTask) * (manifest.count + 1));
+    FreeSlotsTaskGroup group = {0};
+    started = stats_begin_phase(stats, STATS_PHASE_QUERY);
+
+    for (int i = 0; i < manifest.count; i++) {
+        tasks[i] = (GroupTask){&manifest.groups[i], store, config};
+        if (pool) {
+            freeslots_pool_submit(pool, &group, compute_group_task, &tasks[i]);
         } else {
-            merged_starts[*merged_count] = current_start;
-            merged_ends[*merged_count] = current_end;
-            (*merged_count)++;
+            compute_group_task(&tasks[i]);
+        }
+    }
+    if (pool) freeslots_pool_wait(pool, &group);
+    free(tasks);
+
+    for (int i = 0; i < manifest.count; i++) {
+        Group *group = &manifest.groups[i];
+        printf("Group: %s\n", group->name);
+        printf("Date         Start   End     Duration(min)\n");
+        printf("-------------------------------------------\n");
+        fwrite(group->output, 1, group->output_size, stdout);
+        printf("\n");
+
+        if (stats->enabled) {
+            for (size_t j = 0; j < group->output_size; j++) {
+                stats->slots += group->output[j] == '\n';
+            }
+        }
+    }
+    stats_end_phase(stats, STATS_PHASE_QUERY, started);
+
+    if (stats->enabled) {
+        stats->duplicates = freeslots_store_duplicate_count(store);
+        stats->days = freeslots_store_day_count(store);
+    }
+
+    freeslots_store_destroy(store);
+    free_manifest(&manifest);
+    free_calendar_paths(&paths);
+    return 1;
+}
+
+// The report follows the slots, so flush them first in case stdout and
+// stderr share a terminal. Writes the --trace file last, once every span has
+// closed.
+int finish_reports(Stats *stats, const char *trace_path) {
+    trace_begin("output flush", NULL);
+    fflush(stdout);
+    trace_end(NULL, 0);
+
+    if (stats->enabled) {
+        if (!stats->isa) stats->isa = freeslots_isa();
+        stats_print(stats, stderr);
+    }
+    perf_counters_close(stats->perf);
+    stats->perf = NULL;
+
+    return !trace_path || trace_write(trace_path);
+}
 
-            current_start = next_start;
-            current_end = next_end;
+// Finds every file up front, for runs that need the whole list before
+// reading any of it. The paths belong to the discovery.
+const char **expand_inputs(Discovery *discovery, int *count) {
+    const char **paths = NULL;
+    int capacity = 0;
+    const char *path;
+
+    *count = 0;
+    while (discovery_next(discovery, 1, &path) > 0) {
+        if (*count >= capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            paths = realloc(paths, sizeof(char *) * capacity);
         }
+        paths[(*count)++] = path;
     }
+    return paths;
+}
 
-    if (current_start != -1) {
-        merged_starts[*merged_count] = current_start;
-        merged_ends[*merged_count] = current_end;
-        (*merged_count)++;
+// The day number after `day`, moving to the next month after the 31st, so
+// that days past the end of a month, which calendar rows may name, are
+// visited too.
+static Date next_day_number(Date day) {
+    if (day.day < 31) {
+        day.day++;
+    } else if (day.month < 12) {
+        day = (Date){day.year, day.month + 1, 1};
+    } else {
+        day = (Date){day.year + 1, 1, 1};
     }
+    return day;
 }
 
-void print_time_slot(Date date, int start_minutes, int end_minutes) {
-    int start_hours = start_minutes / 60;
-    int start_mins = start_minutes % 60;
-    int end_hours = end_minutes / 60;
-    int end_mins = end_minutes % 60;
-    int duration = end_minutes - start_minutes;
+// Prints the free and busy minutes inside the query's window for every day
+// of its date range, or of the busy days when the range is open, and the
+// totals of those rows. Days past the end of a month get a row only when
+// they are busy in the window, as the free slots would show them. Each day is
+// a lookup in a busy index rather than a merge.
+void print_aggregate(const FreeSlotsStore *store,
+                     const FreeSlotsQuery *aggregate) {
+    trace_begin("busy index", NULL);
+    FreeSlotsBusyIndex *index = freeslots_busy_index_create(store, NULL, 0);
+    trace_end(NULL, 0);
+
+    Date from = aggregate->from;
+    Date to = aggregate->to;
+    Date first, last;
+    if (freeslots_busy_index_days(index, &first, &last)) {
+        if (!from.year) from = first;
+        if (!to.year) to = last;
+    } else if (!from.year || !to.year) {
+        printf("No events found. All time is free!\n");
+        freeslots_busy_index_destroy(index);
+        return;
+    }
 
-    printf("%04d-%02d-%02d   %02d:%02d   %02d:%02d   %d\n", date.year,
-           date.month, date.day, start_hours, start_mins, end_hours, end_mins,
-           duration);
+    int window_start = aggregate->config.window_start_minutes;
+    int window_end = aggregate->config.window_end_minutes;
+    int window = window_end - window_start;
+
+    printf("Date         Free(min)   Busy(min)\n");
+    printf("-------------------------------------\n");
+
+    trace_begin("aggregate", NULL);
+    long day_count = 0;
+    long total_busy = 0;
+    for (Date day = from; freeslots_compare_dates(day, to) <= 0;
+         day = next_day_number(day)) {
+        int busy = freeslots_busy_index_busy_minutes(index, day, window_start,
+                                                     window_end);
+        // Adding no days turns a day past the end of a month into a real one.
+        int real_day =
+            freeslots_compare_dates(freeslots_add_days(day, 0), day) == 0;
+        if (!real_day && busy == 0) continue;
+
+        printf("%04d-%02d-%02d   %-9d   %d\n", day.year, day.month, day.day,
+               window - busy, busy);
+        day_count++;
+        total_busy += busy;
+    }
+    printf("Total        %-9ld   %ld\n", day_count * window - total_busy,
+           total_busy);
+    trace_end("days", day_count);
+
+    freeslots_busy_index_destroy(index);
 }
 
-void print_free_slots_for_day(Date date, Event *day_events, int event_count,
-                              Config config) {
-    int merged_starts[100];
-    int merged_ends[100];
-    int merged_count;
+// Loads the calendars and prints the free slots, the answers to the queries
+// in `queries_path` or, with `aggregate` set, the free minutes per day. With
+// `report` set the slots are followed by their report. With `expanded` set the
+// inputs are plain files.
+int run_calendars(const char *const *inputs, int input_count, int expanded,
+                  Config config, const char *queries_path,
+                  const FreeSlotsQuery *aggregate, Report *report,
+                  LoaderBackend loader, FreeSlotsPool *pool, Stats *stats) {
+    FreeSlotsStore *store = freeslots_store_create();
+    freeslots_store_set_isa(store, stats->isa);
+    if (trace_enabled()) {
+        freeslots_store_set_span_callback(store, trace_library_span, NULL);
+    }
 
-    merge_intervals_for_day(
-        day_events, event_count, config.window_start_minutes,
-        config.window_end_minutes, merged_starts, merged_ends, &merged_count);
+    int ok = expanded ? load_calendar_files(store, (char *const *)inputs,
+                                            input_count, loader, pool, stats)
+                      : load_calendar_inputs(store, (char *const *)inputs,
+                                             input_count, loader, pool,
+                                             stats);
+    if (!ok) {
+        freeslots_store_destroy(store);
+        return 0;
+    }
 
-    int last_end = config.window_start_minutes;
+    printf("Loaded %ld events total\n\n", freeslots_store_event_count(store));
 
-    for (int i = 0; i < merged_count; i++) {
-        int gap_start = last_end;
-        int gap_end = merged_starts[i];
+    double started = stats_begin_phase(stats, STATS_PHASE_INDEX);
+    trace_begin("build index", NULL);
+    freeslots_store_build_index_parallel(store, pool);
+    trace_end("busy intervals", freeslots_store_busy_count(store));
+    stats_end_phase(stats, STATS_PHASE_INDEX, started);
+    if (stats->enabled) {
+        stats->duplicates = freeslots_store_duplicate_count(store);
+        stats->days = freeslots_store_day_count(store);
+    }
 
-        if (gap_end - gap_start >= config.minimum_slot_minutes) {
-            print_time_slot(date, gap_start, gap_end);
+    if (queries_path) {
+        QueryBatch batch = {0};
+        batch.calendar_count = freeslots_store_calendar_count(store);
+
+        if (!load_queries_from_file(queries_path, &batch)) {
+            fprintf(stderr, "Error loading queries: %s\n", queries_path);
+            free_query_batch(&batch);
+            freeslots_store_destroy(store);
+            return 0;
         }
 
-        last_end = merged_ends[i];
+        printf("Loaded %d queries\n\n", batch.count);
+
+        printf("Query        Date         Start   End     Duration(min)\n");
+        printf("--------------------------------------------------------\n");
+        started = stats_begin_phase(stats, STATS_PHASE_QUERY);
+        trace_begin("query batch", NULL);
+        freeslots_query_batch(store, batch.queries, batch.count,
+                              print_query_slot, &batch);
+        trace_end("slots", batch.slot_count);
+        stats_end_phase(stats, STATS_PHASE_QUERY, started);
+
+        stats->slots = batch.slot_count;
+        free_query_batch(&batch);
+        freeslots_store_destroy(store);
+        return 1;
+    }
+
+    if (aggregate) {
+        started = stats_begin_phase(stats, STATS_PHASE_QUERY);
+        print_aggregate(store, aggregate);
+        stats_end_phase(stats, STATS_PHASE_QUERY, started);
+        freeslots_store_destroy(store);
+        return 1;
     }
 
-    if (config.window_end_minutes - last_end >= config.minimum_slot_minutes) {
-        print_time_slot(date, last_end, config.window_end_minutes);
+    if (freeslots_store_event_count(store) == 0) {
+        printf("No events found. All time is free!\n");
+        freeslots_store_destroy(store);
+        return 1;
     }
+
+    printf("Free Time Slots:\n");
+    printf("Date         Start   End     Duration(min)\n");
+    printf("-------------------------------------------\n");
+
+    FreeSlotsQuery query = {.config = config,
+                            .on_day = report ? report_slot_day : NULL};
+    SlotSink sink = {stdout, stats, report};
+    started = stats_begin_phase(stats, STATS_PHASE_QUERY);
+    trace_begin("query", NULL);
+    freeslots_query_parallel(store, &query, pool, print_slot, &sink);
+    trace_end("slots", stats->slots);
+    stats_end_phase(stats, STATS_PHASE_QUERY, started);
+    if (report) report_print(report, stdout);
+
+    freeslots_store_destroy(store);
+    return 1;
 }
 
-int parse_window_argument(const char *arg, int *start_minutes,
-                          int *end_minutes) {
-    const char *dash = strchr(arg, '-');
-    if (!dash) {
+// Replays the output of an earlier identical run from the cache, or runs and
+// stores the output. The key covers the options that shape the output, the
+// query file and every input file, so the inputs are found up front; a run
+// with inputs that cannot be fingerprinted, such as pipes, skips the cache.
+int run_cached(char *const *inputs, int input_count, Config config,
+               const char *queries_path, const FreeSlotsQuery *aggregate,
+               Report *report, const char *cache_path, size_t cache_size,
+               LoaderBackend loader, FreeSlotsPool *pool, Stats *stats) {
+    Discovery *discovery = discovery_start(inputs, input_count);
+    int path_count;
+    const char **paths = expand_inputs(discovery, &path_count);
+    if (!discovery_finish(discovery)) {
+        free(paths);
+        discovery_destroy(discovery);
         return 0;
     }
 
-    char start_str[6] = {0};
-    char end_str[6] = {0};
+    CacheKey key = {0};
+    const char version[] = "freeslots 1";
+    int header[] = {config.window_start_minutes, config.window_end_minutes,
+                    config.minimum_slot_minutes, queries_path != NULL,
+                    aggregate != NULL, report != NULL, path_count};
+    cache_key_add(&key, version, sizeof(version));
+    cache_key_add(&key, header, sizeof(header));
+    if (aggregate) {
+        cache_key_add(&key, &aggregate->from, sizeof(Date));
+        cache_key_add(&key, &aggregate->to, sizeof(Date));
+    }
+    int cacheable = !queries_path || cache_key_add_file(&key, queries_path);
+    for (int i = 0; i < path_count && cacheable; i++) {
+        cacheable = cache_key_add_file(&key, paths[i]);
+    }
 
-    int start_len = dash - arg;
-    if (start_len != 5) {
+    ResultCache *cache =
+        cacheable ? result_cache_open(cache_path, cache_size) : NULL;
+    stats->cache = cache ? "miss" : "skipped";
+
+    int ok = 1;
+    if (cache && result_cache_replay(cache, &key, STDOUT_FILENO)) {
+        stats->cache = "hit";
+    } else {
+        OutputCapture *capture =
+            cache ? output_capture_start(result_cache_room(cache, &key))
+                  : NULL;
+        ok = run_calendars(paths, path_count, 1, config, queries_path,
+                           aggregate, report, loader, pool, stats);
+
+        size_t size;
+        char *output = output_capture_finish(capture, &size);
+        if (ok && output) result_cache_store(cache, &key, output, size);
+        free(output);
+    }
+
+    result_cache_close(cache);
+    cache_key_free(&key);
+    free(paths);
+    discovery_destroy(discovery);
+    return ok;
+}
+
+// Streams the slots of sorted files through the pipeline. They go to a
+// temporary file, and each file's skipped rows to a buffer, so that the
+// output comes in the same order as in a normal run, with the skipped rows
+// under their file and the event count ahead of the slots, and a file found
+// to be unsorted halfway leaves no slots.
+int run_sorted(const char *const *paths, int path_count, Config config,
+               Report *report, Stats *stats) {
+    FILE *slots = tmpfile();
+    if (!slots) {
+        fprintf(stderr, "Error: Cannot create a temporary file\n");
         return 0;
     }
 
-    if (strlen(dash + 1) != 5) {
+    char **logs = calloc(path_count + 1, sizeof(char *));
+    size_t *log_sizes = calloc(path_count + 1, sizeof(size_t));
+    SkipLog *skip_logs = malloc(sizeof(SkipLog) * (path_count + 1));
+    void **skip_data = malloc(sizeof(void *) * (path_count + 1));
+    for (int i = 0; i < path_count; i++) {
+        skip_logs[i] = (SkipLog){open_memstream(&logs[i], &log_sizes[i]),
+                                 stats};
+        skip_data[i] = &skip_logs[i];
+    }
+
+    long event_count;
+    SlotSink sink = {slots, stats, report};
+    int ok = run_sorted_pipeline(paths, path_count, config, print_slot,
+                                 report ? report_slot_day : NULL, &sink,
+                                 print_skipped_line, skip_data, &event_count,
+                                 stats);
+    stats->events = event_count;
+
+    for (int i = 0; i < path_count; i++) {
+        fclose(skip_logs[i].log);
+        printf("Loading events from: %s\n", paths[i]);
+        fwrite(logs[i], 1, log_sizes[i], stdout);
+        free(logs[i]);
+    }
+    free(logs);
+    free(log_sizes);
+    free(skip_logs);
+    free(skip_data);
+
+    if (!ok) {
+        fclose(slots);
         return 0;
     }
 
-    strncpy(start_str, arg, 5);
-    strcpy(end_str, dash + 1);
+    printf("Loaded %ld events total\n\n", event_count);
+    if (event_count == 0) {
+        printf("No events found. All time is free!\n");
+        fclose(slots);
+        return 1;
+    }
 
-    *start_minutes = parse_time_to_minutes(start_str);
-    *end_minutes = parse_time_to_minutes(end_str);
+    printf("Free Time Slots:\n");
+    printf("Date         Start   End     Duration(min)\n");
+    printf("-------------------------------------------\n");
+    rewind(slots);
+    char buffer[64 * 1024];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), slots)) > 0) {
+        fwrite(buffer, 1, size, stdout);
+    }
+    fclose(slots);
 
-    return (*start_minutes >= 0 && *end_minutes >= 0 &&
-            *start_minutes <= *end_minutes);
+    if (report) report_print(report, stdout);
+    return 1;
 }
 
 void print_usage(const char *program_name) {
     fprintf(
         stderr,
-        "Usage: %s [-w HH:MM-HH:MM] [-m MINUTES] file1.csv [file2.csv ...]\n\n"
+        "Usage: %s [-w HH:MM-HH:MM] [-m MINUTES] [--queries FILE] file1.csv "
+        "[file2.csv ...]\n"
+        "       %s [-w HH:MM-HH:MM] [-m MINUTES] --manifest FILE\n"
+        "       %s [-w HH:MM-HH:MM] [-m MINUTES] --sorted file1.csv "
+        "[file2.csv ...]\n"
+        "       %s [-w HH:MM-HH:MM] --aggregate FROM..TO|* file1.csv "
+        "[file2.csv ...]\n\n"
         "Finds free time slots by analyzing busy times from CSV files.\n\n"
         "CSV format: start_date,start_time,end_date,end_time\n"
         "Date format: YYYY-MM-DD\n"
         "Time format: HH:MM\n\n"
+        "Inputs may also be directories, walked for *.csv files, and quoted\n"
+        "glob patterns.\n\n"
         "Options:\n"
         "  -w HH:MM-HH:MM  Daily time window (default: 00:00-24:00)\n"
-        "  -m MINUTES      Minimum free slot length in minutes (default: 0)\n\n"
+        "  -m MINUTES      Minimum free slot length in minutes (default: 0)\n"
+        "  --queries FILE  Answer every query in FILE in one pass, one per line:\n"
+        "                  ID HH:MM-HH:MM MINUTES [FROM..TO|*] [1,2,...|*]\n"
+        "                  (the last field picks input files by position)\n"
+        "  --manifest FILE Free slots per group; each line is\n"
+        "                  GROUP file1.csv [file2.csv ...]\n"
+        "  --sorted        Stream the files through reader, parser and\n"
+        "                  merger threads; each file's rows must be sorted\n"
+        "                  by start date on their own\n"
+        "  --threads N     Worker threads for loading, sorting and merging\n"
+        "                  (default: number of online CPUs)\n"
+        "  --affinity      Pin each worker thread to its own CPU\n"
+        "  --loader NAME   Read the files with io_uring or pread (default:\n"
+        "                  io_uring where the kernel supports it)\n"
+        "  --stats         Print phase timings, throughput and counters to\n"
+        "                  stderr\n"
+        "  --perf-counters Like --stats, plus cycles, IPC, cache and branch\n"
+        "                  misses per phase over all threads\n"
+        "  --trace FILE    Write a Chrome trace-event timeline of every\n"
+        "                  thread to FILE (open it in Perfetto)\n"
+        "  --aggregate FROM..TO|*\n"
+        "                  Print the free and busy minutes inside the window\n"
+        "                  for every day from FROM to TO (* for every day\n"
+        "                  with events) instead of the slots\n"
+        "  --report        Follow the slots with the free minutes per day and\n"
+        "                  weekday, a histogram of slot lengths and the\n"
+        "                  median and 90th percentile slot length per week\n"
+        "  --cache FILE    Replay the output of an earlier run with the same\n"
+        "                  options and unchanged files from FILE, or store\n"
+        "                  this run's output there\n"
+        "  --cache-size MB Size of a new cache file; an existing one keeps\n"
+        "                  its size (default: 64)\n"
+        "  --force-isa ISA Use the scalar, sse2, sse4.2, avx2 or avx512\n"
+        "                  kernels instead of the widest the CPU supports\n\n"
         "Examples:\n"
         "  %s calendar.csv\n"
-        "  %s -w 09:00-17:00 -m 30 cal1.csv cal2.csv\n",
-        program_name, program_name, program_name);
+        "  %s -w 09:00-17:00 -m 30 cal1.csv cal2.csv\n"
+        "  %s --queries planning.txt cal1.csv cal2.csv\n"
+        "  %s -w 08:15-17:00 --manifest groups.txt\n"
+        "  %s -m 30 calendars/ 'archive/*.csv'\n",
+        program_name, program_name, program_name, program_name, program_name,
+        program_name, program_name, program_name, program_name);
 }
 
 int main(int argc, char *argv[]) {
     Config config = {.window_start_minutes = 0,
                      .window_end_minutes = 24 * 60,
                      .minimum_slot_minutes = 0};
+    const char *queries_path = NULL;
+    const char *manifest_path = NULL;
+    int sorted_input = 0;
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    int pin_threads = 0;
+    LoaderBackend loader = LOADER_AUTO;
+    Stats stats = {.started = stats_now(), .days = -1};
+    int perf_counters = 0;
+    const char *trace_path = NULL;
+    const char *cache_path = NULL;
+    size_t cache_size = (size_t)64 << 20;
+    FreeSlotsQuery aggregate_query = {0};
+    const FreeSlotsQuery *aggregate = NULL;
+    static Report report_state;
+    Report *report = NULL;
 
     int arg_index = 1;
     while (arg_index < argc && argv[arg_index][0] == '-') {
@@ -460,6 +1135,152 @@ int main(int argc, char *argv[]) {
             }
             arg_index += 2;
 
+        } else if (strcmp(argv[arg_index], "--queries") == 0) {
+            if (arg_index + 1 >= argc) {
+                fprintf(stderr,
+                        "Error: --queries option requires an argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            queries_path = argv[arg_index + 1];
+            arg_index += 2;
+
+        } else if (strcmp(argv[arg_index], "--manifest") == 0) {
+            if (arg_index + 1 >= argc) {
+                fprintf(stderr,
+                        "Error: --manifest option requires an argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            manifest_path = argv[arg_index + 1];
+            arg_index += 2;
+
+        } else if (strcmp(argv[arg_index], "--sorted") == 0) {
+            sorted_input = 1;
+            arg_index++;
+
+        } else if (strcmp(argv[arg_index], "--aggregate") == 0) {
+            if (arg_index + 1 >= argc) {
+                fprintf(stderr,
+                        "Error: --aggregate option requires an argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            if (!parse_date_range(argv[arg_index + 1], &aggregate_query.from,
+                                  &aggregate_query.to)) {
+                fprintf(stderr, "Error: Invalid date range %s\n",
+                        argv[arg_index + 1]);
+                return 1;
+            }
+            aggregate = &aggregate_query;
+            arg_index += 2;
+
+        } else if (strcmp(argv[arg_index], "--report") == 0) {
+            report = &report_state;
+            arg_index++;
+
+        } else if (strcmp(argv[arg_index], "--cache") == 0) {
+            if (arg_index + 1 >= argc) {
+                fprintf(stderr, "Error: --cache option requires an argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            cache_path = argv[arg_index + 1];
+            arg_index += 2;
+
+        } else if (strcmp(argv[arg_index], "--cache-size") == 0) {
+            if (arg_index + 1 >= argc) {
+                fprintf(stderr,
+                        "Error: --cache-size option requires an argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            long megabytes = atol(argv[arg_index + 1]);
+            if (megabytes < 1) {
+                fprintf(stderr, "Error: --cache-size must be at least 1\n");
+                return 1;
+            }
+            cache_size = (size_t)megabytes << 20;
+            arg_index += 2;
+
+        } else if (strcmp(argv[arg_index], "--threads") == 0) {
+            if (arg_index + 1 >= argc) {
+                fprintf(stderr,
+                        "Error: --threads option requires an argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            thread_count = atoi(argv[arg_index + 1]);
+            if (thread_count < 1) {
+                fprintf(stderr, "Error: --threads must be at least 1\n");
+                return 1;
+            }
+            arg_index += 2;
+
+        } else if (strcmp(argv[arg_index], "--loader") == 0) {
+            if (arg_index + 1 >= argc) {
+                fprintf(stderr,
+                        "Error: --loader option requires an argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            if (strcmp(argv[arg_index + 1], "io_uring") == 0) {
+                loader = LOADER_IO_URING;
+            } else if (strcmp(argv[arg_index + 1], "pread") == 0) {
+                loader = LOADER_PREAD;
+            } else {
+                fprintf(stderr, "Error: --loader must be io_uring or pread\n");
+                return 1;
+            }
+            arg_index += 2;
+
+        } else if (strcmp(argv[arg_index], "--affinity") == 0) {
+            pin_threads = 1;
+            arg_index++;
+
+        } else if (strcmp(argv[arg_index], "--stats") == 0) {
+            stats.enabled = 1;
+            arg_index++;
+
+        } else if (strcmp(argv[arg_index], "--trace") == 0) {
+            if (arg_index + 1 >= argc) {
+                fprintf(stderr, "Error: --trace option requires an argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            trace_path = argv[arg_index + 1];
+            arg_index += 2;
+
+        } else if (strcmp(argv[arg_index], "--force-isa") == 0) {
+            if (arg_index + 1 >= argc) {
+                fprintf(stderr,
+                        "Error: --force-isa option requires an argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            if (!freeslots_isa_supported(argv[arg_index + 1])) {
+                fprintf(stderr,
+                        "Error: Unknown or unsupported instruction set %s\n",
+                        argv[arg_index + 1]);
+                return 1;
+            }
+            stats.isa = argv[arg_index + 1];
+            arg_index += 2;
+
+        } else if (strcmp(argv[arg_index], "--perf-counters") == 0) {
+            stats.enabled = 1;
+            perf_counters = 1;
+            arg_index++;
+
         } else {
             fprintf(stderr, "Error: Unknown option %s\n", argv[arg_index]);
             print_usage(argv[0]);
@@ -467,57 +1288,99 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (arg_index >= argc) {
+    if (manifest_path) {
+        if (arg_index < argc || queries_path || sorted_input) {
+            fprintf(stderr, "Error: --manifest takes its files from the "
+                            "manifest\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (aggregate && (manifest_path || sorted_input || queries_path)) {
+        fprintf(stderr, "Error: --aggregate cannot be combined with "
+                        "--manifest, --sorted or --queries\n");
+        return 1;
+    }
+    aggregate_query.config = config;
+
+    if (report && (manifest_path || queries_path || aggregate)) {
+        fprintf(stderr, "Error: --report cannot be combined with "
+                        "--manifest, --queries or --aggregate\n");
+        return 1;
+    }
+    if (report) report_init(report);
+
+    if (cache_path && (manifest_path || sorted_input)) {
+        fprintf(stderr, "Error: --cache cannot be combined with --manifest "
+                        "or --sorted\n");
+        return 1;
+    }
+
+    if (!manifest_path && arg_index >= argc) {
         fprintf(stderr, "Error: No CSV files specified\n");
         print_usage(argv[0]);
         return 1;
     }
 
-    EventList *event_list = create_event_list();
+    if (perf_counters) {
+        stats.perf = perf_counters_open();
+    }
+    if (trace_path) {
+        trace_start();
+    }
 
-    for (int i = arg_index; i < argc; i++) {
-        printf("Loading events from: %s\n", argv[i]);
-        if (!load_events_from_csv(argv[i], event_list)) {
-            fprintf(stderr, "Error loading file: %s\n", argv[i]);
-            free_event_list(event_list);
+    if (sorted_input) {
+        if (queries_path) {
+            fprintf(stderr, "Error: --sorted cannot be combined with "
+                            "--queries\n");
             return 1;
         }
-    }
 
-    printf("Loaded %d events total\n\n", event_list->count);
+        // The pipeline opens every file from the start, so the files are
+        // all found first.
+        Discovery *discovery =
+            discovery_start(&argv[arg_index], argc - arg_index);
+        int path_count;
+        const char **paths = expand_inputs(discovery, &path_count);
+        if (!discovery_finish(discovery)) {
+            free(paths);
+            discovery_destroy(discovery);
+            return 1;
+        }
 
-    if (event_list->count == 0) {
-        printf("No events found. All time is free!\n");
-        free_event_list(event_list);
-        return 0;
+        int ok = run_sorted(paths, path_count, config, report, &stats);
+        free(paths);
+        discovery_destroy(discovery);
+        if (ok) ok = finish_reports(&stats, trace_path);
+        return ok ? 0 : 1;
     }
 
-    qsort(event_list->events, event_list->count, sizeof(Event), compare_events);
-
-    printf("Free Time Slots:\n");
-    printf("Date         Start   End     Duration(min)\n");
-    printf("-------------------------------------------\n");
-
-    int current_event_index = 0;
-    while (current_event_index < event_list->count) {
-        Date current_date = event_list->events[current_event_index].date;
-
-        int day_event_count = 0;
-        while (
-            current_event_index + day_event_count < event_list->count &&
-            compare_dates(
-                event_list->events[current_event_index + day_event_count].date,
-                current_date) == 0) {
-            day_event_count++;
-        }
+    if (thread_count < 1) thread_count = 1;
+    FreeSlotsPool *pool = NULL;
+    if (thread_count > 1) {
+        pool = freeslots_pool_create(thread_count, pin_threads);
+    }
 
-        print_free_slots_for_day(current_date,
-                                 &event_list->events[current_event_index],
-                                 day_event_count, config);
+    if (manifest_path) {
+        int ok = run_manifest(manifest_path, config, loader, pool, &stats);
+        freeslots_pool_destroy(pool);
+        if (ok) ok = finish_reports(&stats, trace_path);
+        return ok ? 0 : 1;
+    }
 
-        current_event_index += day_event_count;
+    int ok;
+    if (cache_path) {
+        ok = run_cached(&argv[arg_index], argc - arg_index, config,
+                        queries_path, aggregate, report, cache_path,
+                        cache_size, loader, pool, &stats);
+    } else {
+        ok = run_calendars((const char *const *)&argv[arg_index],
+                           argc - arg_index, 0, config, queries_path,
+                           aggregate, report, loader, pool, &stats);
     }
 
-    free_event_list(event_list);
-    return 0;
-}
\ No newline at end of file
+    freeslots_pool_destroy(pool);
+    if (ok) ok = finish_reports(&stats, trace_path);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "discovery.h"
+#include "trace.h"
+
+#include <dirent.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+struct Discovery {
+    char *const *inputs;
+    int input_count;
+
+    pthread_t thread;
+    int joined;
+    pthread_mutex_t lock;
+    pthread_cond_t found;
+
+    // Guarded by `lock`. Only the discovery thread appends.
+    char **paths;
+    int count;
+    int capacity;
+    int done;
+
+    int next;    // read by the consumer only
+    int failed;  // written by the discovery thread only
+};
+
+static void add_path(Discovery *discovery, char *path) {
+    pthread_mutex_lock(&discovery->lock);
+    if (discovery->count >= discovery->capacity) {
+        discovery->capacity = discovery->capacity ? discovery->capacity * 2
+                                                  : 64;
+        discovery->paths = realloc(discovery->paths,
+                                   sizeof(char *) * discovery->capacity);
+    }
+    discovery->paths[discovery->count++] = path;
+    pthread_cond_signal(&discovery->found);
+    pthread_mutex_unlock(&discovery->lock);
+}
+
+static int is_csv(const char *name) {
+    size_t length = strlen(name);
+    return length > 4 && strcmp(name + length - 4, ".csv") == 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Lists the whole directory and closes it before descending, so the walk
+// holds one directory open at a time however deep it goes.
+static void walk_directory(Discovery *discovery, const char *directory) {
+    DIR *handle = opendir(directory);
+    if (!handle) {
+        fprintf(stderr, "Cannot open directory: %s\n", directory);
+        discovery->failed = 1;
+        return;
+    }
+
+    char **names = NULL;
+    int count = 0;
+    int capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(handle))) {
+        if (entry->d_name[0] == '.') continue;
+        if (count >= capacity) {
+            capacity = capacity ? capacity * 2 : 32;
+            names = realloc(names, sizeof(char *) * capacity);
+        }
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(handle);
+    qsort(names, count, sizeof(char *), compare_names);
+
+    size_t directory_length = strlen(directory);
+    int has_slash = directory_length > 0 &&
+                    directory[directory_length - 1] == '/';
+    for (int i = 0; i < count; i++) {
+        size_t size = directory_length + strlen(names[i]) + 2;
+        char *path = malloc(size);
+        snprintf(path, size, has_slash ? "%s%s" : "%s/%s", directory,
+                 names[i]);
+        free(names[i]);
+
+        struct stat st;
+        int found = lstat(path, &st) == 0;
+        if (found && S_ISDIR(st.st_mode)) {
+            walk_directory(discovery, path);
+            free(path);
+            continue;
+        }
+        if (found && S_ISLNK(st.st_mode)) found = stat(path, &st) == 0;
+
+        if (found && S_ISREG(st.st_mode) && is_csv(path)) {
+            add_path(discovery, path);
+        } else {
+            free(path);
+        }
+    }
+    free(names);
+}
+
+static void expand_path(Discovery *discovery, const char *path) {
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        walk_directory(discovery, path);
+    } else {
+        add_path(discovery, strdup(path));
+    }
+}
+
+// An input that exists is never taken for a pattern, so files with brackets
+// in their names still load. One that neither exists nor looks like a
+// pattern is passed on for the loader to report.
+static void expand_input(Discovery *discovery, const char *input) {
+    struct stat st;
+    if (stat(input, &st) == 0 || !strpbrk(input, "*?[")) {
+        expand_path(discovery, input);
+        return;
+    }
+
+    glob_t matches;
+    int result = glob(input, 0, NULL, &matches);
+    if (result != 0) {
+        if (result == GLOB_NOMATCH) {
+            fprintf(stderr, "No files match: %s\n", input);
+        } else {
+            fprintf(stderr, "Cannot expand pattern: %s\n", input);
+        }
+        discovery->failed = 1;
+        globfree(&matches);
+        return;
+    }
+
+    // glob sorts by collation, which is not byte order in every locale.
+    qsort(matches.gl_pathv, matches.gl_pathc, sizeof(char *), compare_names);
+    for (size_t i = 0; i < matches.gl_pathc; i++) {
+        expand_path(discovery, matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+}
+
+static void *discovery_main(void *arg) {
+    Discovery *discovery = arg;
+    trace_name_thread("discovery");
+
+    trace_begin("discover files", NULL);
+    for (int i = 0; i < discovery->input_count; i++) {
+        expand_input(discovery, discovery->inputs[i]);
+    }
+    trace_end("files", discovery->count);
+
+    pthread_mutex_lock(&discovery->lock);
+    discovery->done = 1;
+    pthread_cond_signal(&discovery->found);
+    pthread_mutex_unlock(&discovery->lock);
+    return NULL;
+}
+
+Discovery *discovery_start(char *const *inputs, int count) {
+    Discovery *discovery = calloc(1, sizeof(Discovery));
+    discovery->inputs = inputs;
+    discovery->input_count = count;
+    pthread_mutex_init(&discovery->lock, NULL);
+    pthread_cond_init(&discovery->found, NULL);
+    pthread_create(&discovery->thread, NULL, discovery_main, discovery);
+    return discovery;
+}
+
+int discovery_next(Discovery *discovery, int wait, const char **path) {
+    int got = 0;
+    pthread_mutex_lock(&discovery->lock);
+    while (wait && discovery->next == discovery->count && !discovery->done) {
+        pthread_cond_wait(&discovery->found, &discovery->lock);
+    }
+    if (discovery->next < discovery->count) {
+        *path = discovery->paths[discovery->next++];
+        got = 1;
+    } else if (discovery->done) {
+        got = -1;
+    }
+    pthread_mutex_unlock(&discovery->lock);
+    return got;
+}
+
+int discovery_finish(Discovery *discovery) {
+    if (!discovery->joined) {
+        pthread_join(discovery->thread, NULL);
+        discovery->joined = 1;
+    }
+    return !discovery->failed;
+}
+
+void discovery_destroy(Discovery *discovery) {
+    if (!discovery) return;
+    discovery_finish(discovery);
+    for (int i = 0; i < discovery->count; i++) {
+        free(discovery->paths[i]);
+    }
+    free(discovery->paths);
+    pthread_cond_destroy(&discovery->found);
+    pthread_mutex_destroy(&discovery->lock);
+    free(discovery);
+}
@@ -0,0 +1,28 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+// Expands the inputs on the command line into calendar files on a thread of
+// its own, so the first files can be read and parsed while later directories
+// are still being listed. A file is taken as given, a directory is walked
+// recursively for *.csv files, and anything else containing *, ? or [ is a
+// glob pattern, whose matches are expanded in turn. Directory entries and
+// glob matches are taken in byte order, depth first, so the file order only
+// depends on the inputs. Hidden entries are skipped, and so are symbolic
+// links to directories, which could lead the walk in circles.
+
+typedef struct Discovery Discovery;
+
+Discovery *discovery_start(char *const *inputs, int count);
+
+// Returns 1 and the next file in `path`, -1 when every input has been
+// expanded, or, when `wait` is 0, 0 if the next file has not been found yet.
+// Paths stay valid until discovery_destroy.
+int discovery_next(Discovery *discovery, int wait, const char **path);
+
+// Waits for the walk to end. Returns 0 if a directory could not be listed or
+// a pattern matched nothing, which have been printed to stderr.
+int discovery_finish(Discovery *discovery);
+
+void discovery_destroy(Discovery *discovery);
+
+#endif  // DISCOVERY_H
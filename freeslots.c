@@ -0,0 +1,2096 @@
+#include "freeslots.h"
+#include "kernels.h"
+#include "pool.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FIELD_LENGTH 32
+
+// Tuning knobs; ./nob bench-matrix overrides them with -D.
+#ifndef PARALLEL_SORT_MIN_RUN
+#define PARALLEL_SORT_MIN_RUN 32768
+#endif
+#ifndef PARALLEL_QUERY_RANGES_PER_THREAD
+#define PARALLEL_QUERY_RANGES_PER_THREAD 8
+#endif
+#ifndef PARALLEL_QUERY_SAMPLES_PER_RANGE
+#define PARALLEL_QUERY_SAMPLES_PER_RANGE 16
+#endif
+// Days of every calendar checked for shared intervals at a time.
+#ifndef SHARED_INTERVAL_WINDOW_DAYS
+#define SHARED_INTERVAL_WINDOW_DAYS 28
+#endif
+
+typedef FreeSlotsDate Date;
+typedef FreeSlotsConfig Config;
+
+// `owner` is the calendar an event was added to. Once the index is built it
+// is the first calendar, in store order, with the same busy interval.
+typedef struct {
+    Date date;
+    int start_minutes;
+    int end_minutes;
+    int owner;
+} Event;
+
+typedef struct {
+    Event *events;
+    int count;
+    int capacity;
+} EventList;
+
+// Once normalized, day d of a calendar is the run of busy intervals
+// events[day_offsets[d], day_offsets[d + 1]).
+typedef struct {
+    EventList *events;
+    int normalized_count;
+    long events_added;
+    long rows_added;
+    int *day_offsets;
+    int day_count;
+} Calendar;
+
+typedef struct {
+    FreeSlotsSpanCallback on_span;
+    void *user_data;
+} SpanReporter;
+
+// `shared_count` is the number of busy intervals owned by an earlier
+// calendar, as of the last index build.
+struct FreeSlotsStore {
+    Calendar *calendars;
+    int count;
+    int capacity;
+    long shared_count;
+    SpanReporter spans;
+    const KernelSet *kernels;
+};
+
+typedef struct {
+    FreeSlotsSkipCallback on_skip;
+    void *user_data;
+} SkipReporter;
+
+typedef struct {
+    Calendar *calendar;
+    int id;
+    FreeSlotsPool *pool;
+    const SpanReporter *spans;
+    const KernelSet *kernels;
+} NormalizeTask;
+
+static EventList *create_event_list() {
+    EventList *list = malloc(sizeof(EventList));
+    list->events = malloc(sizeof(Event) * 10);
+    list->count = 0;
+    list->capacity = 10;
+    return list;
+}
+
+static void add_event(EventList *list, Event event) {
+    if (list->count >= list->capacity) {
+        list->capacity *= 2;
+        list->events = realloc(list->events, sizeof(Event) * list->capacity);
+    }
+    list->events[list->count] = event;
+    list->count++;
+}
+
+static void free_event_list(EventList *list) {
+    free(list->events);
+    free(list);
+}
+
+// Date arithmetic runs on serial day numbers counted from 0000-03-01. Years
+// from DATE_TABLE_FIRST_YEAR to DATE_TABLE_LAST_YEAR are looked up in tables
+// built at compile time; dates outside fall back to the civil formulas.
+#define DATE_TABLE_FIRST_YEAR 1900
+#define DATE_TABLE_LAST_YEAR 2200
+
+#define YEAR_START(y)                                                      \
+    (365L * ((y) - 1) + ((y) - 1) / 4 - ((y) - 1) / 100 + ((y) - 1) / 400 + \
+     306)
+#define YEAR_STARTS_5(y)                                                 \
+    YEAR_START(y), YEAR_START((y) + 1), YEAR_START((y) + 2),             \
+        YEAR_START((y) + 3), YEAR_START((y) + 4)
+#define YEAR_STARTS_25(y)                                                \
+    YEAR_STARTS_5(y), YEAR_STARTS_5((y) + 5), YEAR_STARTS_5((y) + 10),   \
+        YEAR_STARTS_5((y) + 15), YEAR_STARTS_5((y) + 20)
+#define YEAR_STARTS_100(y)                                               \
+    YEAR_STARTS_25(y), YEAR_STARTS_25((y) + 25), YEAR_STARTS_25((y) + 50), \
+        YEAR_STARTS_25((y) + 75)
+
+// Serial day of January 1 of every table year, plus the year after the last.
+static const long year_starts[] = {
+    YEAR_STARTS_100(1900), YEAR_STARTS_100(2000), YEAR_STARTS_100(2100),
+    YEAR_START(2200), YEAR_START(2201)};
+
+static const short month_starts[2][13] = {
+    {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365},
+    {0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335, 366}};
+
+static const unsigned char days_per_month[2][12] = {
+    {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31},
+    {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31}};
+
+static int is_table_year(int year) {
+    return year >= DATE_TABLE_FIRST_YEAR && year <= DATE_TABLE_LAST_YEAR;
+}
+
+static int is_leap_year(int year) {
+    if (is_table_year(year)) {
+        int index = year - DATE_TABLE_FIRST_YEAR;
+        return year_starts[index + 1] - year_starts[index] == 366;
+    }
+    return (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+}
+
+static int days_in_month(int year, int month) {
+    return days_per_month[is_leap_year(year)][month - 1];
+}
+
+static int compare_dates(Date date1, Date date2) {
+    if (date1.year != date2.year) {
+        return date1.year - date2.year;
+    }
+    if (date1.month != date2.month) {
+        return date1.month - date2.month;
+    }
+    return date1.day - date2.day;
+}
+
+// Days since 0000-03-01 in the proleptic Gregorian calendar. A day past the
+// end of its month, which parse_date lets through, counts into the next one.
+static long days_from_civil(Date date) {
+    if (is_table_year(date.year)) {
+        return year_starts[date.year - DATE_TABLE_FIRST_YEAR] +
+               month_starts[is_leap_year(date.year)][date.month - 1] +
+               date.day - 1;
+    }
+
+    long year = date.year - (date.month <= 2);
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long year_of_era = year - era * 400;
+    long day_of_year =
+        (153 * (date.month + (date.month > 2 ? -3 : 9)) + 2) / 5 + date.day -
+        1;
+    return era * 146097 + year_of_era * 365 + year_of_era / 4 -
+           year_of_era / 100 + day_of_year;
+}
+
+static Date civil_from_days(long days) {
+    Date date;
+    long first = year_starts[0];
+    long last = year_starts[DATE_TABLE_LAST_YEAR - DATE_TABLE_FIRST_YEAR + 1];
+
+    if (days >= first && days < last) {
+        // Counting 366 days a year falls behind by under a day a year, so
+        // over the table the estimate is at most one year early.
+        int index = (int)(days - first) / 366;
+        if (days >= year_starts[index + 1]) index++;
+
+        int leap = year_starts[index + 1] - year_starts[index] == 366;
+        int day_of_year = (int)(days - year_starts[index]);
+        int month = day_of_year / 32;
+        if (day_of_year >= month_starts[leap][month + 1]) month++;
+
+        date.year = DATE_TABLE_FIRST_YEAR + index;
+        date.month = month + 1;
+        date.day = day_of_year - month_starts[leap][month] + 1;
+        return date;
+    }
+
+    long era = (days >= 0 ? days : days - 146096) / 146097;
+    long day_of_era = days - era * 146097;
+    long year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+                        day_of_era / 146096) /
+                       365;
+    long day_of_year =
+        day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    long month_index = (5 * day_of_year + 2) / 153;
+
+    date.day = (int)(day_of_year - (153 * month_index + 2) / 5 + 1);
+    date.month = (int)(month_index < 10 ? month_index + 3 : month_index - 9);
+    date.year = (int)(year_of_era + era * 400 + (date.month <= 2));
+    return date;
+}
+
+static Date add_days_to_date(Date date, int days) {
+    int day = date.day + days;
+    if (day >= 1 && day <= days_in_month(date.year, date.month)) {
+        date.day = day;
+        return date;
+    }
+    return civil_from_days(days_from_civil(date) + days);
+}
+
+// 0 is Monday. 0000-03-01 was a Wednesday.
+static int weekday_from_days(long days) {
+    int weekday = (int)((days + 2) % 7);
+    return weekday < 0 ? weekday + 7 : weekday;
+}
+
+static int iso_weeks_in_year(int year) {
+    Date january_first = {year, 1, 1};
+    int weekday = weekday_from_days(days_from_civil(january_first));
+    return weekday == 3 || (weekday == 2 && is_leap_year(year)) ? 53 : 52;
+}
+
+static int parse_time_to_minutes(const char *time_str) {
+    if (strlen(time_str) != 5 || time_str[2] != ':') {
+        return -1;
+    }
+
+    if (!isdigit(time_str[0]) || !isdigit(time_str[1]) ||
+        !isdigit(time_str[3]) || !isdigit(time_str[4])) {
+        return -1;
+    }
+
+    int hours = (time_str[0] - '0') * 10 + (time_str[1] - '0');
+    int minutes = (time_str[3] - '0') * 10 + (time_str[4] - '0');
+
+    if (hours > 24 || minutes > 59 || (hours == 24 && minutes != 0)) {
+        return -1;
+    }
+
+    return hours * 60 + minutes;
+}
+
+static int parse_date(const char *date_str, Date *date) {
+    if (strlen(date_str) != 10 || date_str[4] != '-' || date_str[7] != '-') {
+        return 0;
+    }
+
+    char year_str[5] = {date_str[0], date_str[1], date_str[2], date_str[3], 0};
+    char month_str[3] = {date_str[5], date_str[6], 0};
+    char day_str[3] = {date_str[8], date_str[9], 0};
+
+    date->year = atoi(year_str);
+    date->month = atoi(month_str);
+    date->day = atoi(day_str);
+
+    if (date->month < 1 || date->month > 12 || date->day < 1 ||
+        date->day > 31) {
+        return 0;
+    }
+
+    return 1;
+}
+
+// Splits the first line of text[0, length) into fields. The line ends at a
+// newline, a carriage return or a NUL, whichever comes first.
+static int parse_csv_line(const KernelSet *kernels, const char *line,
+                          size_t length, char fields[][MAX_FIELD_LENGTH],
+                          int max_fields) {
+    int field_count = 0;
+    size_t line_pos = 0;
+
+    while (line_pos < length && field_count < max_fields) {
+        size_t field_length =
+            kernels->field_end(line + line_pos, length - line_pos);
+        size_t copied = field_length < MAX_FIELD_LENGTH - 1
+                            ? field_length
+                            : MAX_FIELD_LENGTH - 1;
+        memcpy(fields[field_count], line + line_pos, copied);
+        fields[field_count][copied] = '\0';
+        line_pos += field_length;
+
+        if (line_pos == length || line[line_pos] == '\0') {
+            if (field_length > 0) field_count++;
+            break;
+        }
+
+        char c = line[line_pos];
+        field_count++;
+        if (c == '\r' && line_pos + 1 < length && line[line_pos + 1] == '\n') {
+            line_pos++;
+        }
+        if (c == '\n' || c == '\r') {
+            break;
+        }
+        line_pos++;
+    }
+
+    return field_count;
+}
+
+// Tries the vectorized parser, which takes the common strict form, before the
+// lenient one.
+static int parse_date_in_field(const KernelSet *kernels, const char *field,
+                               Date *date) {
+    return kernels->parse_date_field(field, date) || parse_date(field, date);
+}
+
+static void process_multi_day_event(EventList *event_list, Date start_date,
+                                    Date end_date, int start_minutes,
+                                    int end_minutes, int calendar) {
+    Date current_date = start_date;
+
+    while (compare_dates(current_date, end_date) <= 0) {
+        Event daily_event;
+        daily_event.date = current_date;
+        daily_event.owner = calendar;
+
+        if (compare_dates(current_date, start_date) == 0) {
+            daily_event.start_minutes = start_minutes;
+        } else {
+            daily_event.start_minutes = 0;
+        }
+
+        if (compare_dates(current_date, end_date) == 0) {
+            daily_event.end_minutes = end_minutes;
+        } else {
+            daily_event.end_minutes = 24 * 60;
+        }
+
+        if (daily_event.end_minutes > daily_event.start_minutes) {
+            add_event(event_list, daily_event);
+        }
+
+        current_date = add_days_to_date(current_date, 1);
+    }
+}
+
+static void begin_span(const SpanReporter *spans, const char *name) {
+    if (spans->on_span) {
+        spans->on_span(name, 0, 0, spans->user_data);
+    }
+}
+
+static void end_span(const SpanReporter *spans, const char *name, long count) {
+    if (spans->on_span) {
+        spans->on_span(name, 1, count, spans->user_data);
+    }
+}
+
+static void report_skip(const SkipReporter *reporter, int line_number,
+                        const char *reason, const char *field) {
+    if (reporter->on_skip) {
+        reporter->on_skip(line_number, reason, field, reporter->user_data);
+    }
+}
+
+static int parse_csv_row(const KernelSet *kernels, const char *line,
+                         size_t length, int line_number, FreeSlotsEvent *event,
+                         const SkipReporter *reporter) {
+    char fields[4][MAX_FIELD_LENGTH];
+    int field_count = parse_csv_line(kernels, line, length, fields, 4);
+
+    if (field_count < 4) {
+        report_skip(reporter, line_number, "insufficient fields", NULL);
+        return 0;
+    }
+
+    if (!parse_date_in_field(kernels, fields[0], &event->start_date)) {
+        report_skip(reporter, line_number, "invalid start date", fields[0]);
+        return 0;
+    }
+
+    if (!parse_date_in_field(kernels, fields[2], &event->end_date)) {
+        report_skip(reporter, line_number, "invalid end date", fields[2]);
+        return 0;
+    }
+
+    event->start_minutes = parse_time_to_minutes(fields[1]);
+    event->end_minutes = parse_time_to_minutes(fields[3]);
+
+    if (event->start_minutes < 0) {
+        report_skip(reporter, line_number, "invalid start time", fields[1]);
+        return 0;
+    }
+
+    if (event->end_minutes < 0) {
+        report_skip(reporter, line_number, "invalid end time", fields[3]);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Calls on_event for every valid row in the buffer and returns the number of
+// lines consumed.
+static int parse_csv_rows(const KernelSet *kernels, const char *data,
+                          size_t size, int first_line_number,
+                          FreeSlotsEventCallback on_event, void *user_data,
+                          const SkipReporter *reporter) {
+    const char *cursor = data;
+    const char *end = data + size;
+    int line_number = first_line_number - 1;
+    FreeSlotsEvent event;
+
+    while (cursor < end) {
+        line_number++;
+
+        const char *newline = memchr(cursor, '\n', end - cursor);
+        if (newline) {
+            if (parse_csv_row(kernels, cursor, newline - cursor + 1,
+                              line_number, &event, reporter)) {
+                on_event(&event, user_data);
+            }
+            cursor = newline + 1;
+            continue;
+        }
+
+        // The last line may not be terminated, and the caller's buffer need
+        // not be NUL-terminated either, so parse a private copy of it.
+        size_t length = end - cursor;
+        char *line = malloc(length + 1);
+        memcpy(line, cursor, length);
+        line[length] = '\0';
+        if (parse_csv_row(kernels, line, length, line_number, &event,
+                          reporter)) {
+            on_event(&event, user_data);
+        }
+        free(line);
+        break;
+    }
+
+    return line_number - first_line_number + 1;
+}
+
+typedef struct {
+    EventList *event_list;
+    int calendar;
+    long rows;
+} CalendarLoader;
+
+static void add_row_to_calendar(const FreeSlotsEvent *event,
+                                void *user_data) {
+    CalendarLoader *loader = user_data;
+    loader->rows++;
+    process_multi_day_event(loader->event_list, event->start_date,
+                            event->end_date, event->start_minutes,
+                            event->end_minutes, loader->calendar);
+}
+
+// Returns the number of valid rows.
+static long load_events_from_csv(const KernelSet *kernels, const char *data,
+                                 size_t size, EventList *event_list,
+                                 int calendar, const SkipReporter *reporter) {
+    CalendarLoader loader = {event_list, calendar, 0};
+    parse_csv_rows(kernels, data, size, 1, add_row_to_calendar, &loader,
+                   reporter);
+    return loader.rows;
+}
+
+static int compare_events(const void *a, const void *b) {
+    const Event *event1 = (const Event *)a;
+    const Event *event2 = (const Event *)b;
+
+    int date_comparison = compare_dates(event1->date, event2->date);
+    if (date_comparison != 0) {
+        return date_comparison;
+    }
+
+    if (event1->start_minutes != event2->start_minutes) {
+        return event1->start_minutes - event2->start_minutes;
+    }
+
+    return event1->end_minutes - event2->end_minutes;
+}
+
+// Takes one day's intervals as start and end columns, sorted by start, and
+// writes the disjoint busy intervals inside the window to the merged columns,
+// which need room for `event_count` entries and may alias the input.
+static void merge_intervals_for_day(const KernelSet *kernels,
+                                    const int *starts, const int *ends,
+                                    int event_count, int window_start,
+                                    int window_end, int *merged_starts,
+                                    int *merged_ends, int *merged_count) {
+    int kept = kernels->clamp_filter(starts, ends, event_count, window_start,
+                                     window_end, merged_starts, merged_ends);
+
+    *merged_count = 0;
+    for (int i = 0; i < kept; i++) {
+        int last = *merged_count - 1;
+        if (last >= 0 && merged_starts[i] <= merged_ends[last]) {
+            if (merged_ends[i] > merged_ends[last]) {
+                merged_ends[last] = merged_ends[i];
+            }
+            continue;
+        }
+
+        merged_starts[*merged_count] = merged_starts[i];
+        merged_ends[*merged_count] = merged_ends[i];
+        (*merged_count)++;
+    }
+}
+
+static void emit_slot(int query, Date date, int start_minutes, int end_minutes,
+                      FreeSlotsSlotCallback on_slot, void *user_data) {
+    FreeSlotsSlot slot = {query, date, start_minutes, end_minutes};
+    on_slot(&slot, user_data);
+}
+
+static void emit_free_slots_for_day(int query, Date date,
+                                    const int *merged_starts,
+                                    const int *merged_ends, int merged_count,
+                                    Config config,
+                                    FreeSlotsSlotCallback on_slot,
+                                    void *user_data) {
+    int last_end = config.window_start_minutes;
+
+    for (int i = 0; i < merged_count; i++) {
+        int busy_start = merged_starts[i];
+        int busy_end = merged_ends[i];
+
+        if (busy_start < config.window_start_minutes)
+            busy_start = config.window_start_minutes;
+        if (busy_end > config.window_end_minutes)
+            busy_end = config.window_end_minutes;
+
+        if (busy_end <= config.window_start_minutes ||
+            busy_start >= config.window_end_minutes) {
+            continue;
+        }
+
+        if (busy_start - last_end >= config.minimum_slot_minutes) {
+            emit_slot(query, date, last_end, busy_start, on_slot, user_data);
+        }
+
+        last_end = busy_end;
+    }
+
+    if (config.window_end_minutes - last_end >= config.minimum_slot_minutes) {
+        emit_slot(query, date, last_end, config.window_end_minutes, on_slot,
+                  user_data);
+    }
+}
+
+#define DAY_MINUTES (24 * 60)
+
+// Orders dates like compare_dates, but as one number. Unlike a serial day it
+// keeps days past the end of a month, which parse_date accepts, distinct.
+static long date_key(Date date) {
+    return ((long)date.year * 12 + date.month - 1) * 31 + date.day - 1;
+}
+
+static uint64_t hash_key(uint64_t key, int bits) {
+    return (key * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+}
+
+static int hash_bits(long count) {
+    int bits = 1;
+    while ((1L << bits) < 2 * count) bits++;
+    return bits;
+}
+
+static int compare_longs(const void *a, const void *b) {
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+// Replaces each day number with the index of its bucket and returns the
+// bucket count. Over a dense range the bucket is the offset from the first
+// day; a calendar that spans centuries with few events instead gets one
+// bucket per distinct day, found through a hash of the day.
+static int assign_day_buckets(long *days, int count) {
+    long first = days[0], last = days[0];
+    for (int i = 1; i < count; i++) {
+        if (days[i] < first) first = days[i];
+        if (days[i] > last) last = days[i];
+    }
+
+    if (last - first < 4L * count + 4096) {
+        for (int i = 0; i < count; i++) days[i] -= first;
+        return (int)(last - first + 1);
+    }
+
+    int bits = hash_bits(count);
+    size_t mask = ((size_t)1 << bits) - 1;
+    long *keys = malloc(sizeof(long) * (mask + 1));
+    int *buckets = malloc(sizeof(int) * (mask + 1));
+    long *distinct = malloc(sizeof(long) * count);
+    int distinct_count = 0;
+    for (size_t i = 0; i <= mask; i++) buckets[i] = -1;
+
+    for (int i = 0; i < count; i++) {
+        size_t slot = hash_key(days[i], bits);
+        while (buckets[slot] >= 0 && keys[slot] != days[i]) {
+            slot = (slot + 1) & mask;
+        }
+        if (buckets[slot] < 0) {
+            keys[slot] = days[i];
+            buckets[slot] = 0;
+            distinct[distinct_count++] = days[i];
+        }
+    }
+
+    qsort(distinct, distinct_count, sizeof(long), compare_longs);
+    for (int b = 0; b < distinct_count; b++) {
+        size_t slot = hash_key(distinct[b], bits);
+        while (keys[slot] != distinct[b]) slot = (slot + 1) & mask;
+        buckets[slot] = b;
+    }
+    for (int i = 0; i < count; i++) {
+        size_t slot = hash_key(days[i], bits);
+        while (keys[slot] != days[i]) slot = (slot + 1) & mask;
+        days[i] = buckets[slot];
+    }
+
+    free(distinct);
+    free(buckets);
+    free(keys);
+    return distinct_count;
+}
+
+static int compare_interval_keys(const void *a, const void *b) {
+    uint64_t key1 = *(const uint64_t *)a;
+    uint64_t key2 = *(const uint64_t *)b;
+    return (key1 > key2) - (key1 < key2);
+}
+
+// Orders one day's intervals by start and end. Days hold a handful of
+// lectures, where insertion sort beats qsort's call overhead; larger days are
+// packed into one key per interval and sorted as plain integers.
+static void sort_day(int *starts, int *ends, int count) {
+    if (count > 16) {
+        uint64_t *keys = malloc(sizeof(uint64_t) * count);
+        for (int i = 0; i < count; i++) {
+            keys[i] = (uint64_t)((uint32_t)starts[i] ^ 0x80000000u) << 32 |
+                      ((uint32_t)ends[i] ^ 0x80000000u);
+        }
+        qsort(keys, count, sizeof(uint64_t), compare_interval_keys);
+        for (int i = 0; i < count; i++) {
+            starts[i] = (int)((uint32_t)(keys[i] >> 32) ^ 0x80000000u);
+            ends[i] = (int)((uint32_t)keys[i] ^ 0x80000000u);
+        }
+        free(keys);
+        return;
+    }
+
+    for (int i = 1; i < count; i++) {
+        int start = starts[i], end = ends[i];
+        int j = i;
+        while (j > 0 && (start < starts[j - 1] ||
+                         (start == starts[j - 1] && end < ends[j - 1]))) {
+            starts[j] = starts[j - 1];
+            ends[j] = ends[j - 1];
+            j--;
+        }
+        starts[j] = start;
+        ends[j] = end;
+    }
+}
+
+// A calendar's events grouped by day, with each day's start and end minutes
+// in columns. Day b is [offsets[b], offsets[b + 1]); empty days have no date.
+typedef struct {
+    int *starts;
+    int *ends;
+    int *offsets;
+    Date *dates;
+    int bucket_count;
+} DayBuckets;
+
+typedef struct {
+    const DayBuckets *buckets;
+    int first_bucket;
+    int last_bucket;
+    const SpanReporter *spans;
+} SortDaysTask;
+
+static void sort_days_task(void *arg) {
+    SortDaysTask *task = arg;
+    const DayBuckets *buckets = task->buckets;
+    begin_span(task->spans, "sort days");
+    for (int b = task->first_bucket; b < task->last_bucket; b++) {
+        int first = buckets->offsets[b];
+        sort_day(buckets->starts + first, buckets->ends + first,
+                 buckets->offsets[b + 1] - first);
+    }
+    end_span(task->spans, "sort days",
+             buckets->offsets[task->last_bucket] -
+                 buckets->offsets[task->first_bucket]);
+}
+
+// Sorts the list by (date, start, end) with a counting sort on the day: one
+// pass counts the events of each bucket, a second scatters their minutes into
+// place, and only the events within a day are compared. Large lists sort
+// their days as pool tasks of at least PARALLEL_SORT_MIN_RUN events.
+static void bucket_events(const EventList *list, long *days,
+                          FreeSlotsPool *pool, const SpanReporter *spans,
+                          DayBuckets *buckets) {
+    int count = list->count;
+    buckets->bucket_count = count > 0 ? assign_day_buckets(days, count) : 0;
+    buckets->offsets = calloc(buckets->bucket_count + 1, sizeof(int));
+    buckets->dates = malloc(sizeof(Date) * (buckets->bucket_count + 1));
+    buckets->starts = malloc(sizeof(int) * (count + 1));
+    buckets->ends = malloc(sizeof(int) * (count + 1));
+
+    int *offsets = buckets->offsets;
+    for (int i = 0; i < count; i++) offsets[days[i] + 1]++;
+    for (int b = 0; b < buckets->bucket_count; b++) {
+        offsets[b + 1] += offsets[b];
+    }
+
+    int *cursors = malloc(sizeof(int) * (buckets->bucket_count + 1));
+    memcpy(cursors, offsets, sizeof(int) * (buckets->bucket_count + 1));
+    for (int i = 0; i < count; i++) {
+        const Event *event = &list->events[i];
+        int position = cursors[days[i]]++;
+        buckets->starts[position] = event->start_minutes;
+        buckets->ends[position] = event->end_minutes;
+        buckets->dates[days[i]] = event->date;
+    }
+    free(cursors);
+
+    int task_count = pool ? freeslots_pool_thread_count(pool) * 4 : 1;
+    if (task_count > count / PARALLEL_SORT_MIN_RUN) {
+        task_count = count / PARALLEL_SORT_MIN_RUN;
+    }
+    if (task_count < 2) {
+        SortDaysTask task = {buckets, 0, buckets->bucket_count, spans};
+        sort_days_task(&task);
+        return;
+    }
+
+    SortDaysTask *tasks = malloc(sizeof(SortDaysTask) * task_count);
+    FreeSlotsTaskGroup group = {0};
+    int first_bucket = 0;
+    for (int t = 0; t < task_count && first_bucket < buckets->bucket_count;
+         t++) {
+        long target = (long)count * (t + 1) / task_count;
+        int last_bucket = first_bucket + 1;
+        while (last_bucket < buckets->bucket_count &&
+               offsets[last_bucket] < target) {
+            last_bucket++;
+        }
+        if (t == task_count - 1) last_bucket = buckets->bucket_count;
+
+        tasks[t] = (SortDaysTask){buckets, first_bucket, last_bucket, spans};
+        freeslots_pool_submit(pool, &group, sort_days_task, &tasks[t]);
+        first_bucket = last_bucket;
+    }
+    freeslots_pool_wait(pool, &group);
+    free(tasks);
+}
+
+static void normalize_busy_intervals(EventList *list, int calendar,
+                                     FreeSlotsPool *pool,
+                                     const SpanReporter *spans,
+                                     const KernelSet *kernels) {
+    long *days = malloc(sizeof(long) * (list->count + 1));
+    for (int i = 0; i < list->count; i++) {
+        days[i] = date_key(list->events[i].date);
+    }
+
+    begin_span(spans, "sort");
+    DayBuckets buckets;
+    bucket_events(list, days, pool, spans, &buckets);
+    end_span(spans, "sort", list->count);
+    free(days);
+
+    begin_span(spans, "merge days");
+
+    // The columns hold every event, so the list can take the merged days in
+    // any order; each day is merged in place in its own slice.
+    int write_index = 0;
+    for (int b = 0; b < buckets.bucket_count; b++) {
+        int first = buckets.offsets[b];
+        int day_event_count = buckets.offsets[b + 1] - first;
+        if (day_event_count == 0) continue;
+
+        int merged_count;
+        merge_intervals_for_day(kernels, buckets.starts + first,
+                                buckets.ends + first, day_event_count, 0,
+                                24 * 60,
+                                buckets.starts + first, buckets.ends + first,
+                                &merged_count);
+
+        for (int i = 0; i < merged_count; i++) {
+            Event busy = {buckets.dates[b], buckets.starts[first + i],
+                          buckets.ends[first + i], calendar};
+            list->events[write_index++] = busy;
+        }
+    }
+
+    list->count = write_index;
+    end_span(spans, "merge days", list->count);
+    free(buckets.starts);
+    free(buckets.ends);
+    free(buckets.offsets);
+    free(buckets.dates);
+}
+
+// Splits a normalized calendar into its day runs.
+static void index_calendar_days(Calendar *calendar) {
+    const EventList *list = calendar->events;
+    free(calendar->day_offsets);
+    calendar->day_offsets = malloc(sizeof(int) * (list->count + 1));
+
+    int day_count = 0;
+    int first = 0;
+    while (first < list->count) {
+        int last = first + 1;
+        while (last < list->count &&
+               compare_dates(list->events[last].date,
+                             list->events[first].date) == 0) {
+            last++;
+        }
+        calendar->day_offsets[day_count++] = first;
+        first = last;
+    }
+    calendar->day_offsets[day_count] = list->count;
+    calendar->day_count = day_count;
+}
+
+// Packs a busy interval's date key, start and end minute into one nonzero
+// key. Parsed years have four digits, so the date key fits in 22 bits.
+static uint64_t interval_key(const Event *event) {
+    return (uint64_t)(date_key(event->date) + 1024) << 22 |
+           (uint64_t)event->start_minutes << 11 |
+           (uint64_t)event->end_minutes;
+}
+
+typedef struct {
+    uint64_t key;
+    int owner;
+} SharedInterval;
+
+// Students in a cohort share most lectures, so most busy intervals repeat one
+// of an earlier calendar. Sets each interval's owner to the first calendar
+// that has it, so that a union including that calendar drops the others, and
+// returns how many intervals were repeats. The calendars are walked together
+// a few weeks at a time, which keeps the set small.
+static long mark_shared_intervals(FreeSlotsStore *store) {
+    int *days = calloc(store->count + 1, sizeof(int));
+    int *last_days = malloc(sizeof(int) * (store->count + 1));
+    SharedInterval *set = NULL;
+    int set_bits = 0;
+    long shared = 0;
+
+    for (;;) {
+        long first_key = -1;
+        for (int c = 0; c < store->count; c++) {
+            const Calendar *calendar = &store->calendars[c];
+            if (days[c] == calendar->day_count) continue;
+            long key = date_key(
+                calendar->events->events[calendar->day_offsets[days[c]]].date);
+            if (first_key < 0 || key < first_key) first_key = key;
+        }
+        if (first_key < 0) break;
+
+        long interval_count = 0;
+        for (int c = 0; c < store->count; c++) {
+            const Calendar *calendar = &store->calendars[c];
+            const Event *events = calendar->events->events;
+            int day = days[c];
+            while (day < calendar->day_count &&
+                   date_key(events[calendar->day_offsets[day]].date) <
+                       first_key + SHARED_INTERVAL_WINDOW_DAYS) {
+                day++;
+            }
+            last_days[c] = day;
+            interval_count +=
+                calendar->day_offsets[day] - calendar->day_offsets[days[c]];
+        }
+
+        int bits = hash_bits(interval_count);
+        if (bits > set_bits) {
+            set_bits = bits;
+            free(set);
+            set = malloc(sizeof(SharedInterval) << set_bits);
+        }
+        size_t mask = ((size_t)1 << bits) - 1;
+        memset(set, 0, sizeof(SharedInterval) << bits);
+
+        for (int c = 0; c < store->count; c++) {
+            const Calendar *calendar = &store->calendars[c];
+            Event *event = calendar->events->events +
+                           calendar->day_offsets[days[c]];
+            Event *end = calendar->events->events +
+                         calendar->day_offsets[last_days[c]];
+            for (; event < end; event++) {
+                uint64_t key = interval_key(event);
+                size_t slot = hash_key(key, bits);
+                while (set[slot].key && set[slot].key != key) {
+                    slot = (slot + 1) & mask;
+                }
+                if (set[slot].key) {
+                    shared++;
+                } else {
+                    set[slot] = (SharedInterval){key, c};
+                }
+                event->owner = set[slot].owner;
+            }
+            days[c] = last_days[c];
+        }
+    }
+
+    free(set);
+    free(days);
+    free(last_days);
+    return shared;
+}
+
+// The next day run of one calendar, with the date key of its day so the heap
+// compares one number.
+typedef struct {
+    const Calendar *calendar;
+    int id;
+    int day;
+    long key;
+} BusyCursor;
+
+static Date cursor_date(const BusyCursor *cursor) {
+    const Calendar *calendar = cursor->calendar;
+    return calendar->events->events[calendar->day_offsets[cursor->day]].date;
+}
+
+static void cursor_load_key(BusyCursor *cursor) {
+    if (cursor->day < cursor->calendar->day_count) {
+        cursor->key = date_key(cursor_date(cursor));
+    }
+}
+
+static void sift_down_cursor(BusyCursor *cursors, int *heap, int heap_size,
+                             int index) {
+    for (;;) {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+
+        if (left < heap_size &&
+            cursors[heap[left]].key < cursors[heap[smallest]].key) {
+            smallest = left;
+        }
+        if (right < heap_size &&
+            cursors[heap[right]].key < cursors[heap[smallest]].key) {
+            smallest = right;
+        }
+        if (smallest == index) return;
+
+        int swap = heap[index];
+        heap[index] = heap[smallest];
+        heap[smallest] = swap;
+        index = smallest;
+    }
+}
+
+// The part of one calendar's day run not yet merged into the union.
+typedef struct {
+    const Event *next;
+    const Event *end;
+    int calendar;
+} DayRun;
+
+// Heap entries pack a run's next start above its index, so the heap orders
+// runs by their next interval with plain integer compares.
+static uint64_t run_heap_entry(const DayRun *run, int index) {
+    return (uint64_t)(uint32_t)run->next->start_minutes << 32 |
+           (uint32_t)index;
+}
+
+static void sift_down_run(uint64_t *heap, int heap_size, int index) {
+    uint64_t entry = heap[index];
+    for (;;) {
+        int smallest = 2 * index + 1;
+        if (smallest >= heap_size) break;
+        if (smallest + 1 < heap_size && heap[smallest + 1] < heap[smallest]) {
+            smallest++;
+        }
+        if (entry <= heap[smallest]) break;
+
+        heap[index] = heap[smallest];
+        index = smallest;
+    }
+    heap[index] = entry;
+}
+
+// Streams the day-by-day union of a set of normalized calendars. A heap
+// orders the calendars by their next day, and the runs on the current day are
+// merged by a second heap over their next intervals. An interval owned by
+// another calendar in the union is left to that calendar's run.
+typedef struct {
+    BusyCursor *cursors;
+    int *heap;
+    int heap_size;
+    char *included;
+    DayRun *runs;
+    uint64_t *run_heap;
+    Date day;
+    int *merged_starts;
+    int *merged_ends;
+    int merged_count;
+    int capacity;
+} UnionCursor;
+
+static int lower_bound_run(const Calendar *calendar, Date date) {
+    int low = 0;
+    int high = calendar->day_count;
+
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        const Event *first =
+            &calendar->events->events[calendar->day_offsets[middle]];
+        if (compare_dates(first->date, date) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static void union_cursor_init(UnionCursor *cursor,
+                              const FreeSlotsStore *store,
+                              const int *calendars, int calendar_count,
+                              Date from) {
+    memset(cursor, 0, sizeof(UnionCursor));
+    cursor->cursors = malloc(sizeof(BusyCursor) * (calendar_count + 1));
+    cursor->heap = malloc(sizeof(int) * (calendar_count + 1));
+    cursor->runs = malloc(sizeof(DayRun) * (calendar_count + 1));
+    cursor->run_heap = malloc(sizeof(uint64_t) * (calendar_count + 1));
+    cursor->included = calloc(store->count + 1, 1);
+
+    for (int c = 0; c < calendar_count; c++) {
+        const Calendar *calendar = &store->calendars[calendars[c]];
+        cursor->included[calendars[c]] = 1;
+        cursor->cursors[c].calendar = calendar;
+        cursor->cursors[c].id = calendars[c];
+        cursor->cursors[c].day =
+            from.year ? lower_bound_run(calendar, from) : 0;
+        cursor_load_key(&cursor->cursors[c]);
+        if (cursor->cursors[c].day < calendar->day_count) {
+            cursor->heap[cursor->heap_size++] = c;
+        }
+    }
+
+    for (int i = cursor->heap_size / 2 - 1; i >= 0; i--) {
+        sift_down_cursor(cursor->cursors, cursor->heap, cursor->heap_size, i);
+    }
+}
+
+static int union_cursor_peek(const UnionCursor *cursor, Date *day) {
+    if (cursor->heap_size == 0) return 0;
+    *day = cursor_date(&cursor->cursors[cursor->heap[0]]);
+    return 1;
+}
+
+// Steps past the intervals of `calendar` that another calendar in the union
+// owns.
+static const Event *skip_shared(const UnionCursor *cursor, int calendar,
+                                const Event *next, const Event *end) {
+    while (next < end && next->owner != calendar &&
+           cursor->included[next->owner]) {
+        next++;
+    }
+    return next;
+}
+
+static int union_cursor_next_day(UnionCursor *cursor) {
+    if (!union_cursor_peek(cursor, &cursor->day)) return 0;
+    long key = cursor->cursors[cursor->heap[0]].key;
+
+    int run_count = 0;
+    int interval_count = 0;
+    while (cursor->heap_size > 0) {
+        BusyCursor *head = &cursor->cursors[cursor->heap[0]];
+        if (head->key != key) break;
+
+        const Calendar *calendar = head->calendar;
+        int id = head->id;
+        int day = head->day++;
+        cursor_load_key(head);
+        if (head->day == calendar->day_count) {
+            cursor->heap[0] = cursor->heap[--cursor->heap_size];
+        }
+        sift_down_cursor(cursor->cursors, cursor->heap, cursor->heap_size, 0);
+
+        const Event *events =
+            calendar->events->events + calendar->day_offsets[day];
+        int count = calendar->day_offsets[day + 1] - calendar->day_offsets[day];
+        const Event *next = skip_shared(cursor, id, events, events + count);
+        if (next == events + count) continue;
+
+        cursor->runs[run_count] = (DayRun){next, events + count, id};
+        cursor->run_heap[run_count] =
+            run_heap_entry(&cursor->runs[run_count], run_count);
+        run_count++;
+        interval_count += count;
+    }
+
+    if (interval_count > cursor->capacity) {
+        while (interval_count > cursor->capacity) {
+            cursor->capacity = cursor->capacity ? cursor->capacity * 2 : 64;
+        }
+        cursor->merged_starts =
+            realloc(cursor->merged_starts, sizeof(int) * cursor->capacity);
+        cursor->merged_ends =
+            realloc(cursor->merged_ends, sizeof(int) * cursor->capacity);
+    }
+
+    // Every run is sorted and disjoint, so taking the earliest next interval
+    // of any run gives the day in start order, to be merged as it comes.
+    DayRun *runs = cursor->runs;
+    uint64_t *run_heap = cursor->run_heap;
+    int heap_size = run_count;
+    for (int i = heap_size / 2 - 1; i >= 0; i--) {
+        sift_down_run(run_heap, heap_size, i);
+    }
+
+    int *starts = cursor->merged_starts, *ends = cursor->merged_ends;
+    int merged_count = 0;
+    while (heap_size > 0) {
+        int index = (int)(uint32_t)run_heap[0];
+        DayRun *run = &runs[index];
+        int start = run->next->start_minutes, end = run->next->end_minutes;
+        run->next = skip_shared(cursor, run->calendar, run->next + 1, run->end);
+        if (run->next == run->end) {
+            run_heap[0] = run_heap[--heap_size];
+        } else {
+            run_heap[0] = run_heap_entry(run, index);
+        }
+        if (heap_size > 1) sift_down_run(run_heap, heap_size, 0);
+
+        if (merged_count > 0 && start <= ends[merged_count - 1]) {
+            if (end > ends[merged_count - 1]) ends[merged_count - 1] = end;
+        } else {
+            starts[merged_count] = start;
+            ends[merged_count++] = end;
+        }
+    }
+    cursor->merged_count = merged_count;
+    return 1;
+}
+
+static void union_cursor_free(UnionCursor *cursor) {
+    free(cursor->cursors);
+    free(cursor->heap);
+    free(cursor->runs);
+    free(cursor->run_heap);
+    free(cursor->included);
+    free(cursor->merged_starts);
+    free(cursor->merged_ends);
+}
+
+static int is_date_in_range(Date date, Date from, Date to) {
+    return (from.year == 0 || compare_dates(date, from) >= 0) &&
+           (to.year == 0 || compare_dates(date, to) <= 0);
+}
+
+static int is_store_indexed(const FreeSlotsStore *store) {
+    for (int i = 0; i < store->count; i++) {
+        if (store->calendars[i].normalized_count !=
+            store->calendars[i].events->count) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Resolves a query's calendar selection into a sorted list of distinct ids.
+static int *resolve_query_calendars(const FreeSlotsStore *store,
+                                    const FreeSlotsQuery *query, int *count) {
+    char *included = calloc(store->count + 1, 1);
+
+    if (!query->calendars) {
+        memset(included, 1, store->count);
+    } else {
+        for (int i = 0; i < query->calendar_count; i++) {
+            int calendar = query->calendars[i];
+            if (calendar < 0 || calendar >= store->count) {
+                free(included);
+                return NULL;
+            }
+            included[calendar] = 1;
+        }
+    }
+
+    int *calendars = malloc(sizeof(int) * (store->count + 1));
+    *count = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (included[i]) calendars[(*count)++] = i;
+    }
+
+    free(included);
+    return calendars;
+}
+
+FreeSlotsStore *freeslots_store_create(void) {
+    FreeSlotsStore *store = calloc(1, sizeof(FreeSlotsStore));
+    store->kernels = kernels_default();
+    return store;
+}
+
+void freeslots_store_destroy(FreeSlotsStore *store) {
+    if (!store) return;
+
+    for (int i = 0; i < store->count; i++) {
+        free_event_list(store->calendars[i].events);
+        free(store->calendars[i].day_offsets);
+    }
+    free(store->calendars);
+    free(store);
+}
+
+int freeslots_store_add_calendar(FreeSlotsStore *store) {
+    if (store->count >= store->capacity) {
+        store->capacity = store->capacity ? store->capacity * 2 : 16;
+        store->calendars =
+            realloc(store->calendars, sizeof(Calendar) * store->capacity);
+    }
+
+    store->calendars[store->count] = (Calendar){0};
+    store->calendars[store->count].events = create_event_list();
+    return store->count++;
+}
+
+int freeslots_store_add_csv(FreeSlotsStore *store, int calendar,
+                            const char *data, size_t size,
+                            FreeSlotsSkipCallback on_skip, void *user_data) {
+    if (calendar < 0 || calendar >= store->count) {
+        return 0;
+    }
+
+    EventList *events = store->calendars[calendar].events;
+    SkipReporter reporter = {on_skip, user_data};
+    int first_event = events->count;
+
+    begin_span(&store->spans, "parse csv");
+    store->calendars[calendar].rows_added +=
+        load_events_from_csv(store->kernels, data, size, events, calendar,
+                             &reporter);
+    store->calendars[calendar].events_added += events->count - first_event;
+    end_span(&store->spans, "parse csv", events->count - first_event);
+    return 1;
+}
+
+int freeslots_store_add_event(FreeSlotsStore *store, int calendar,
+                              const FreeSlotsEvent *event) {
+    if (calendar < 0 || calendar >= store->count) {
+        return 0;
+    }
+
+    EventList *events = store->calendars[calendar].events;
+    int first_event = events->count;
+
+    process_multi_day_event(events, event->start_date, event->end_date,
+                            event->start_minutes, event->end_minutes,
+                            calendar);
+    store->calendars[calendar].rows_added++;
+    store->calendars[calendar].events_added += events->count - first_event;
+    return 1;
+}
+
+int freeslots_store_build_index(FreeSlotsStore *store) {
+    return freeslots_store_build_index_parallel(store, NULL);
+}
+
+static void normalize_calendar_task(void *arg) {
+    NormalizeTask *task = arg;
+    Calendar *calendar = task->calendar;
+
+    normalize_busy_intervals(calendar->events, task->id, task->pool,
+                             task->spans, task->kernels);
+    index_calendar_days(calendar);
+    calendar->normalized_count = calendar->events->count;
+}
+
+int freeslots_store_build_index_parallel(FreeSlotsStore *store,
+                                         FreeSlotsPool *pool) {
+    NormalizeTask *tasks = malloc(sizeof(NormalizeTask) * (store->count + 1));
+    FreeSlotsTaskGroup group = {0};
+    int changed = 0;
+
+    for (int i = 0; i < store->count; i++) {
+        Calendar *calendar = &store->calendars[i];
+        if (calendar->normalized_count == calendar->events->count) continue;
+
+        changed = 1;
+        tasks[i] =
+            (NormalizeTask){calendar, i, pool, &store->spans, store->kernels};
+        if (pool) {
+            freeslots_pool_submit(pool, &group, normalize_calendar_task,
+                                  &tasks[i]);
+        } else {
+            normalize_calendar_task(&tasks[i]);
+        }
+    }
+
+    if (pool) freeslots_pool_wait(pool, &group);
+    free(tasks);
+
+    if (changed) {
+        begin_span(&store->spans, "mark shared");
+        store->shared_count = mark_shared_intervals(store);
+        end_span(&store->spans, "mark shared", store->shared_count);
+    }
+    return 1;
+}
+
+void freeslots_store_set_span_callback(FreeSlotsStore *store,
+                                       FreeSlotsSpanCallback on_span,
+                                       void *user_data) {
+    store->spans = (SpanReporter){on_span, user_data};
+}
+
+int freeslots_store_set_isa(FreeSlotsStore *store, const char *isa) {
+    const KernelSet *kernels = kernels_for_isa(isa);
+    if (!kernels) return 0;
+    store->kernels = kernels;
+    return 1;
+}
+
+int freeslots_store_calendar_count(const FreeSlotsStore *store) {
+    return store->count;
+}
+
+long freeslots_store_event_count(const FreeSlotsStore *store) {
+    long count = 0;
+    for (int i = 0; i < store->count; i++) {
+        count += store->calendars[i].events_added;
+    }
+    return count;
+}
+
+long freeslots_store_busy_count(const FreeSlotsStore *store) {
+    long count = 0;
+    for (int i = 0; i < store->count; i++) {
+        count += store->calendars[i].normalized_count;
+    }
+    return count;
+}
+
+long freeslots_store_row_count(const FreeSlotsStore *store) {
+    long count = 0;
+    for (int i = 0; i < store->count; i++) {
+        count += store->calendars[i].rows_added;
+    }
+    return count;
+}
+
+long freeslots_store_duplicate_count(const FreeSlotsStore *store) {
+    if (!is_store_indexed(store)) {
+        return -1;
+    }
+    return store->shared_count;
+}
+
+long freeslots_store_day_count(const FreeSlotsStore *store) {
+    if (!is_store_indexed(store)) {
+        return -1;
+    }
+
+    FreeSlotsQuery all = {0};
+    int calendar_count;
+    int *calendars = resolve_query_calendars(store, &all, &calendar_count);
+
+    UnionCursor cursor;
+    union_cursor_init(&cursor, store, calendars, calendar_count, (Date){0});
+    long count = 0;
+    while (union_cursor_next_day(&cursor)) {
+        count++;
+    }
+
+    union_cursor_free(&cursor);
+    free(calendars);
+    return count;
+}
+
+int freeslots_query(const FreeSlotsStore *store, const FreeSlotsQuery *query,
+                    FreeSlotsSlotCallback on_slot, void *user_data) {
+    return freeslots_query_batch(store, query, 1, on_slot, user_data);
+}
+
+typedef struct {
+    FreeSlotsSlot *slots;
+    long capacity;
+    long count;
+} SlotBuffer;
+
+static void append_slot_to_buffer(const FreeSlotsSlot *slot, void *user_data) {
+    SlotBuffer *buffer = user_data;
+    if (buffer->count < buffer->capacity) {
+        buffer->slots[buffer->count] = *slot;
+    }
+    buffer->count++;
+}
+
+long freeslots_query_to_buffer(const FreeSlotsStore *store,
+                               const FreeSlotsQuery *query,
+                               FreeSlotsSlot *slots, long capacity) {
+    SlotBuffer buffer = {slots, capacity, 0};
+    FreeSlotsQuery slots_only = *query;
+    slots_only.on_day = NULL;
+    if (!freeslots_query(store, &slots_only, append_slot_to_buffer, &buffer)) {
+        return -1;
+    }
+    return buffer.count;
+}
+
+// A visited day, and how many of the range's slots came before it.
+typedef struct {
+    Date date;
+    long slot_index;
+} RangeDay;
+
+typedef struct {
+    const FreeSlotsStore *store;
+    FreeSlotsQuery query;
+    Date before;
+    FreeSlotsSlot *slots;
+    long count;
+    long capacity;
+    RangeDay *days;
+    long day_count;
+    long day_capacity;
+} RangeTask;
+
+static void append_day_to_range(int query, Date date, void *user_data) {
+    (void)query;
+    RangeTask *task = user_data;
+    if (task->day_count >= task->day_capacity) {
+        task->day_capacity = task->day_capacity ? task->day_capacity * 2 : 64;
+        task->days = realloc(task->days, sizeof(RangeDay) * task->day_capacity);
+    }
+    task->days[task->day_count++] = (RangeDay){date, task->count};
+}
+
+static void append_slot_to_range(const FreeSlotsSlot *slot, void *user_data) {
+    RangeTask *task = user_data;
+    if (task->count >= task->capacity) {
+        task->capacity = task->capacity ? task->capacity * 2 : 256;
+        task->slots =
+            realloc(task->slots, sizeof(FreeSlotsSlot) * task->capacity);
+    }
+    task->slots[task->count++] = *slot;
+}
+
+static int query_batch_before(const FreeSlotsStore *store,
+                              const FreeSlotsQuery *queries, int query_count,
+                              Date before, FreeSlotsSlotCallback on_slot,
+                              void *user_data);
+
+static void query_range_task(void *arg) {
+    RangeTask *task = arg;
+    begin_span(&task->store->spans, "query range");
+    query_batch_before(task->store, &task->query, 1, task->before,
+                       append_slot_to_range, task);
+    end_span(&task->store->spans, "query range", task->count);
+}
+
+static int compare_date_values(const void *a, const void *b) {
+    return compare_dates(*(const Date *)a, *(const Date *)b);
+}
+
+int freeslots_query_parallel(const FreeSlotsStore *store,
+                             const FreeSlotsQuery *query, FreeSlotsPool *pool,
+                             FreeSlotsSlotCallback on_slot, void *user_data) {
+    if (!pool || freeslots_pool_thread_count(pool) < 2) {
+        return freeslots_query(store, query, on_slot, user_data);
+    }
+    if (!is_store_indexed(store)) {
+        return 0;
+    }
+
+    int calendar_count;
+    int *calendars = resolve_query_calendars(store, query, &calendar_count);
+    if (!calendars) {
+        return 0;
+    }
+
+    // Split the days at quantiles of the busy intervals rather than evenly
+    // over the calendar, so a dense exam week does not land in a single task,
+    // and make several ranges per thread so stealing can even out the rest.
+    int range_count =
+        freeslots_pool_thread_count(pool) * PARALLEL_QUERY_RANGES_PER_THREAD;
+    int sample_target = range_count * PARALLEL_QUERY_SAMPLES_PER_RANGE;
+    long busy_count = 0;
+    for (int c = 0; c < calendar_count; c++) {
+        busy_count += store->calendars[calendars[c]].events->count;
+    }
+
+    Date *samples = malloc(sizeof(Date) * (sample_target + calendar_count));
+    int sample_count = 0;
+    for (int c = 0; c < calendar_count; c++) {
+        const EventList *busy = store->calendars[calendars[c]].events;
+        long wanted = busy_count ? (long)busy->count * sample_target /
+                                       busy_count
+                                 : 0;
+        if (wanted < 1) wanted = 1;
+
+        for (long i = 0; i < wanted && busy->count > 0; i++) {
+            samples[sample_count++] =
+                busy->events[(long)busy->count * i / wanted].date;
+        }
+    }
+    free(calendars);
+
+    if (sample_count == 0) {
+        free(samples);
+        return freeslots_query(store, query, on_slot, user_data);
+    }
+    qsort(samples, sample_count, sizeof(Date), compare_date_values);
+
+    // Each range runs from its boundary up to, but not including, the next
+    // one. Compared as dates, this leaves no gap for days past the end of a
+    // month, which stepping back a day from the boundary would skip.
+    RangeTask *tasks = calloc(range_count, sizeof(RangeTask));
+    FreeSlotsTaskGroup group = {0};
+    int task_count = 0;
+    Date range_start = query->from;
+
+    for (int r = 1; r <= range_count; r++) {
+        Date boundary = {0};
+        if (r < range_count) {
+            boundary = samples[(long)sample_count * r / range_count];
+            if (range_start.year && compare_dates(boundary, range_start) <= 0) {
+                continue;
+            }
+        }
+
+        RangeTask *task = &tasks[task_count++];
+        task->store = store;
+        task->query = *query;
+        if (query->on_day) task->query.on_day = append_day_to_range;
+        task->before = boundary;
+        if (query->from.year && (!range_start.year ||
+                                 compare_dates(range_start, query->from) < 0)) {
+            task->query.from = query->from;
+        } else {
+            task->query.from = range_start;
+        }
+
+        Date from = task->query.from;
+        if (from.year && ((query->to.year &&
+                           compare_dates(from, query->to) > 0) ||
+                          (boundary.year &&
+                           compare_dates(from, boundary) >= 0))) {
+            task_count--;
+        } else {
+            freeslots_pool_submit(pool, &group, query_range_task, task);
+        }
+
+        range_start = boundary;
+    }
+    freeslots_pool_wait(pool, &group);
+
+    for (int t = 0; t < task_count; t++) {
+        long day = 0;
+        for (long i = 0; i <= tasks[t].count; i++) {
+            while (day < tasks[t].day_count &&
+                   tasks[t].days[day].slot_index <= i) {
+                query->on_day(0, tasks[t].days[day++].date, user_data);
+            }
+            if (i < tasks[t].count) on_slot(&tasks[t].slots[i], user_data);
+        }
+        free(tasks[t].slots);
+        free(tasks[t].days);
+    }
+
+    free(tasks);
+    free(samples);
+    return 1;
+}
+
+typedef struct {
+    int *calendars;
+    int calendar_count;
+    int *queries;
+    int query_count;
+    Date from;
+    Date to;
+    UnionCursor cursor;
+} QuerySubset;
+
+// Answers the queries for the days before `before`, or every day when its
+// year is 0.
+static int query_batch_before(const FreeSlotsStore *store,
+                              const FreeSlotsQuery *queries, int query_count,
+                              Date before, FreeSlotsSlotCallback on_slot,
+                              void *user_data) {
+    if (!is_store_indexed(store)) {
+        return 0;
+    }
+
+    // Queries that select the same calendars share one subset, so every day
+    // is merged once per distinct subset rather than once per query.
+    QuerySubset *subsets = calloc(query_count + 1, sizeof(QuerySubset));
+    int subset_count = 0;
+    int ok = 1;
+
+    for (int q = 0; q < query_count && ok; q++) {
+        int calendar_count;
+        int *calendars =
+            resolve_query_calendars(store, &queries[q], &calendar_count);
+        if (!calendars) {
+            ok = 0;
+            break;
+        }
+
+        QuerySubset *subset = NULL;
+        for (int s = 0; s < subset_count; s++) {
+            if (subsets[s].calendar_count == calendar_count &&
+                memcmp(subsets[s].calendars, calendars,
+                       sizeof(int) * calendar_count) == 0) {
+                subset = &subsets[s];
+                break;
+            }
+        }
+
+        if (subset) {
+            free(calendars);
+            if (subset->from.year &&
+                (queries[q].from.year == 0 ||
+                 compare_dates(queries[q].from, subset->from) < 0)) {
+                subset->from = queries[q].from;
+            }
+            if (subset->to.year &&
+                (queries[q].to.year == 0 ||
+                 compare_dates(queries[q].to, subset->to) > 0)) {
+                subset->to = queries[q].to;
+            }
+        } else {
+            subset = &subsets[subset_count++];
+            subset->calendars = calendars;
+            subset->calendar_count = calendar_count;
+            subset->queries = malloc(sizeof(int) * query_count);
+            subset->from = queries[q].from;
+            subset->to = queries[q].to;
+        }
+
+        subset->queries[subset->query_count++] = q;
+    }
+
+    for (int s = 0; s < subset_count && ok; s++) {
+        union_cursor_init(&subsets[s].cursor, store, subsets[s].calendars,
+                          subsets[s].calendar_count, subsets[s].from);
+    }
+
+    while (ok) {
+        Date day = {0};
+        int found = 0;
+
+        for (int s = 0; s < subset_count; s++) {
+            Date next;
+            if (union_cursor_peek(&subsets[s].cursor, &next) &&
+                is_date_in_range(next, subsets[s].from, subsets[s].to) &&
+                (!found || compare_dates(next, day) < 0)) {
+                day = next;
+                found = 1;
+            }
+        }
+        if (!found) break;
+        if (before.year && compare_dates(day, before) >= 0) break;
+
+        for (int s = 0; s < subset_count; s++) {
+            QuerySubset *subset = &subsets[s];
+            Date next;
+            if (!union_cursor_peek(&subset->cursor, &next) ||
+                compare_dates(next, day) != 0) {
+                continue;
+            }
+
+            union_cursor_next_day(&subset->cursor);
+
+            for (int i = 0; i < subset->query_count; i++) {
+                const FreeSlotsQuery *query = &queries[subset->queries[i]];
+                if (!is_date_in_range(day, query->from, query->to)) continue;
+                if (query->on_day) {
+                    query->on_day(subset->queries[i], day, user_data);
+                }
+
+                emit_free_slots_for_day(subset->queries[i], day,
+                                        subset->cursor.merged_starts,
+                                        subset->cursor.merged_ends,
+                                        subset->cursor.merged_count,
+                                        query->config, on_slot, user_data);
+            }
+        }
+    }
+
+    for (int s = 0; s < subset_count; s++) {
+        if (ok) union_cursor_free(&subsets[s].cursor);
+        free(subsets[s].calendars);
+        free(subsets[s].queries);
+    }
+    free(subsets);
+    return ok;
+}
+
+int freeslots_query_batch(const FreeSlotsStore *store,
+                          const FreeSlotsQuery *queries, int query_count,
+                          FreeSlotsSlotCallback on_slot, void *user_data) {
+    return query_batch_before(store, queries, query_count, (Date){0}, on_slot,
+                              user_data);
+}
+
+// Day i, with date key days[i], has the intervals [offsets[i],
+// offsets[i + 1]). prefix[i] is the busy time of the intervals before
+// interval i, across days, so the busy time of any run of whole intervals is
+// a subtraction.
+struct FreeSlotsBusyIndex {
+    long *days;
+    Date *dates;
+    int *offsets;
+    int *starts;
+    int *ends;
+    long *prefix;
+    int day_count;
+    int interval_count;
+};
+
+FreeSlotsBusyIndex *freeslots_busy_index_create(const FreeSlotsStore *store,
+                                                const int *calendars,
+                                                int calendar_count) {
+    if (!is_store_indexed(store)) return NULL;
+
+    FreeSlotsQuery selection = {.calendars = calendars,
+                                .calendar_count = calendar_count};
+    int count;
+    int *selected = resolve_query_calendars(store, &selection, &count);
+    if (!selected) return NULL;
+
+    FreeSlotsBusyIndex *index = calloc(1, sizeof(FreeSlotsBusyIndex));
+    int day_capacity = 0;
+    int interval_capacity = 0;
+
+    UnionCursor cursor;
+    union_cursor_init(&cursor, store, selected, count, (Date){0});
+    while (union_cursor_next_day(&cursor)) {
+        if (index->day_count + 1 >= day_capacity) {
+            day_capacity = day_capacity ? day_capacity * 2 : 64;
+            index->days = realloc(index->days, sizeof(long) * day_capacity);
+            index->dates = realloc(index->dates, sizeof(Date) * day_capacity);
+            index->offsets =
+                realloc(index->offsets, sizeof(int) * (day_capacity + 1));
+        }
+        int needed = index->interval_count + cursor.merged_count;
+        if (needed > interval_capacity) {
+            while (needed > interval_capacity) {
+                interval_capacity =
+                    interval_capacity ? interval_capacity * 2 : 256;
+            }
+            index->starts =
+                realloc(index->starts, sizeof(int) * interval_capacity);
+            index->ends = realloc(index->ends, sizeof(int) * interval_capacity);
+        }
+
+        index->days[index->day_count] = date_key(cursor.day);
+        index->dates[index->day_count] = cursor.day;
+        index->offsets[index->day_count++] = index->interval_count;
+        memcpy(index->starts + index->interval_count, cursor.merged_starts,
+               sizeof(int) * cursor.merged_count);
+        memcpy(index->ends + index->interval_count, cursor.merged_ends,
+               sizeof(int) * cursor.merged_count);
+        index->interval_count += cursor.merged_count;
+    }
+    union_cursor_free(&cursor);
+    free(selected);
+
+    if (!index->offsets) index->offsets = malloc(sizeof(int));
+    index->offsets[index->day_count] = index->interval_count;
+
+    index->prefix = malloc(sizeof(long) * (index->interval_count + 1));
+    index->prefix[0] = 0;
+    for (int i = 0; i < index->interval_count; i++) {
+        index->prefix[i + 1] =
+            index->prefix[i] + index->ends[i] - index->starts[i];
+    }
+    return index;
+}
+
+void freeslots_busy_index_destroy(FreeSlotsBusyIndex *index) {
+    if (!index) return;
+    free(index->days);
+    free(index->dates);
+    free(index->offsets);
+    free(index->starts);
+    free(index->ends);
+    free(index->prefix);
+    free(index);
+}
+
+// First day at or after `day`.
+static int lower_bound_day(const FreeSlotsBusyIndex *index, long day) {
+    int low = 0;
+    int high = index->day_count;
+
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (index->days[middle] < day) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Busy minutes before `minute` on day `day_index`. Every interval that starts
+// before it counts in full from the prefix sums except the last, which may
+// run past it.
+static long busy_before(const FreeSlotsBusyIndex *index, int day_index,
+                        int minute) {
+    int first = index->offsets[day_index];
+    int low = first;
+    int high = index->offsets[day_index + 1];
+
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (index->starts[middle] < minute) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == first) return 0;
+
+    int last = low - 1;
+    int end = index->ends[last] < minute ? index->ends[last] : minute;
+    return index->prefix[last] - index->prefix[first] + end -
+           index->starts[last];
+}
+
+static long busy_in_window(const FreeSlotsBusyIndex *index, int day_index,
+                           int window_start, int window_end) {
+    return busy_before(index, day_index, window_end) -
+           busy_before(index, day_index, window_start);
+}
+
+int freeslots_busy_index_busy_minutes(const FreeSlotsBusyIndex *index,
+                                      FreeSlotsDate date,
+                                      int window_start_minutes,
+                                      int window_end_minutes) {
+    long day = date_key(date);
+    int day_index = lower_bound_day(index, day);
+    if (day_index == index->day_count || index->days[day_index] != day) {
+        return 0;
+    }
+    return (int)busy_in_window(index, day_index, window_start_minutes,
+                               window_end_minutes);
+}
+
+long freeslots_busy_index_busy_range(const FreeSlotsBusyIndex *index,
+                                     FreeSlotsDate from, FreeSlotsDate to,
+                                     int window_start_minutes,
+                                     int window_end_minutes) {
+    int first = from.year ? lower_bound_day(index, date_key(from)) : 0;
+    int end = to.year ? lower_bound_day(index, date_key(to) + 1)
+                      : index->day_count;
+    if (first >= end) return 0;
+
+    // A window of the whole day takes every interval of every day in full.
+    if (window_start_minutes <= 0 && window_end_minutes >= DAY_MINUTES) {
+        return index->prefix[index->offsets[end]] -
+               index->prefix[index->offsets[first]];
+    }
+
+    long busy = 0;
+    for (int i = first; i < end; i++) {
+        busy += busy_in_window(index, i, window_start_minutes,
+                               window_end_minutes);
+    }
+    return busy;
+}
+
+int freeslots_busy_index_days(const FreeSlotsBusyIndex *index,
+                              FreeSlotsDate *first, FreeSlotsDate *last) {
+    if (index->day_count == 0) return 0;
+    *first = index->dates[0];
+    *last = index->dates[index->day_count - 1];
+    return 1;
+}
+
+int freeslots_parse_csv(const char *data, size_t size, int first_line_number,
+                        const char *isa, FreeSlotsEventCallback on_event,
+                        FreeSlotsSkipCallback on_skip, void *user_data) {
+    const KernelSet *kernels = kernels_for_isa(isa);
+    SkipReporter reporter = {on_skip, user_data};
+    return parse_csv_rows(kernels ? kernels : kernels_default(), data, size,
+                          first_line_number, on_event, user_data, &reporter);
+}
+
+struct FreeSlotsSweep {
+    Config config;
+    const KernelSet *kernels;
+    FreeSlotsSlotCallback on_slot;
+    FreeSlotsDayCallback on_day;
+    void *user_data;
+    EventList *pending;
+    Date watermark;
+    int *merged_starts;
+    int *merged_ends;
+    int merged_capacity;
+    long event_count;
+};
+
+// Emits every pending day before `limit` (or all of them when limit is NULL)
+// and keeps the rest for later. Only the days being emitted are moved to the
+// front and sorted, so each row is sorted once, with the rest of its day,
+// however many flushes it waits through as part of a multi-day row.
+static void flush_sweep(FreeSlotsSweep *sweep, const Date *limit) {
+    EventList *pending = sweep->pending;
+    int ready = 0;
+    for (int i = 0; i < pending->count; i++) {
+        if (limit && compare_dates(pending->events[i].date, *limit) >= 0) {
+            continue;
+        }
+        Event swap = pending->events[ready];
+        pending->events[ready++] = pending->events[i];
+        pending->events[i] = swap;
+    }
+    qsort(pending->events, ready, sizeof(Event), compare_events);
+
+    if (ready > sweep->merged_capacity) {
+        sweep->merged_capacity = ready;
+        sweep->merged_starts = realloc(sweep->merged_starts,
+                                       sizeof(int) * sweep->merged_capacity);
+        sweep->merged_ends =
+            realloc(sweep->merged_ends, sizeof(int) * sweep->merged_capacity);
+    }
+
+    int index = 0;
+    while (index < ready) {
+        Date date = pending->events[index].date;
+
+        int day_event_count = 0;
+        while (index + day_event_count < ready &&
+               compare_dates(pending->events[index + day_event_count].date,
+                             date) == 0) {
+            day_event_count++;
+        }
+
+        for (int i = 0; i < day_event_count; i++) {
+            sweep->merged_starts[i] = pending->events[index + i].start_minutes;
+            sweep->merged_ends[i] = pending->events[index + i].end_minutes;
+        }
+
+        int merged_count;
+        merge_intervals_for_day(sweep->kernels, sweep->merged_starts,
+                                sweep->merged_ends, day_event_count,
+                                sweep->config.window_start_minutes,
+                                sweep->config.window_end_minutes,
+                                sweep->merged_starts, sweep->merged_ends,
+                                &merged_count);
+        if (sweep->on_day) sweep->on_day(0, date, sweep->user_data);
+        emit_free_slots_for_day(0, date, sweep->merged_starts,
+                                sweep->merged_ends, merged_count,
+                                sweep->config, sweep->on_slot,
+                                sweep->user_data);
+
+        index += day_event_count;
+    }
+
+    memmove(pending->events, pending->events + index,
+            sizeof(Event) * (pending->count - index));
+    pending->count -= index;
+}
+
+FreeSlotsSweep *freeslots_sweep_create(FreeSlotsConfig config,
+                                       FreeSlotsSlotCallback on_slot,
+                                       void *user_data) {
+    FreeSlotsSweep *sweep = calloc(1, sizeof(FreeSlotsSweep));
+    sweep->config = config;
+    sweep->kernels = kernels_default();
+    sweep->on_slot = on_slot;
+    sweep->user_data = user_data;
+    sweep->pending = create_event_list();
+    return sweep;
+}
+
+int freeslots_sweep_add_event(FreeSlotsSweep *sweep,
+                              const FreeSlotsEvent *event) {
+    // Rows arrive in start date order, so no later row can touch a day before
+    // this one and those days are final.
+    int order = compare_dates(event->start_date, sweep->watermark);
+    if (order < 0) {
+        return 0;
+    }
+    if (order > 0) {
+        flush_sweep(sweep, &event->start_date);
+        sweep->watermark = event->start_date;
+    }
+
+    int first_event = sweep->pending->count;
+    process_multi_day_event(sweep->pending, event->start_date, event->end_date,
+                            event->start_minutes, event->end_minutes, 0);
+    sweep->event_count += sweep->pending->count - first_event;
+    return 1;
+}
+
+void freeslots_sweep_set_day_callback(FreeSlotsSweep *sweep,
+                                      FreeSlotsDayCallback on_day) {
+    sweep->on_day = on_day;
+}
+
+int freeslots_sweep_set_isa(FreeSlotsSweep *sweep, const char *isa) {
+    const KernelSet *kernels = kernels_for_isa(isa);
+    if (!kernels) return 0;
+    sweep->kernels = kernels;
+    return 1;
+}
+
+void freeslots_sweep_finish(FreeSlotsSweep *sweep) {
+    flush_sweep(sweep, NULL);
+}
+
+long freeslots_sweep_event_count(const FreeSlotsSweep *sweep) {
+    return sweep->event_count;
+}
+
+void freeslots_sweep_destroy(FreeSlotsSweep *sweep) {
+    if (!sweep) return;
+
+    free_event_list(sweep->pending);
+    free(sweep->merged_starts);
+    free(sweep->merged_ends);
+    free(sweep);
+}
+
+int freeslots_parse_time(const char *time_str) {
+    return parse_time_to_minutes(time_str);
+}
+
+// Calendar rows keep the lenient check, but a range bound past the end of
+// its month would make the per-day walk and the busy index disagree.
+int freeslots_parse_date(const char *date_str, FreeSlotsDate *date) {
+    return parse_date(date_str, date) &&
+           date->day <= days_in_month(date->year, date->month);
+}
+
+const char *freeslots_isa(void) {
+    return kernels_default()->isa;
+}
+
+int freeslots_isa_supported(const char *name) {
+    return kernels_for_isa(name) != NULL;
+}
+
+FreeSlotsDate freeslots_add_days(FreeSlotsDate date, int days) {
+    return add_days_to_date(date, days);
+}
+
+int freeslots_weekday(FreeSlotsDate date) {
+    return weekday_from_days(days_from_civil(date));
+}
+
+int freeslots_iso_week(FreeSlotsDate date, int *iso_year) {
+    long days = days_from_civil(date);
+    Date january_first = {date.year, 1, 1};
+    int day_of_year = (int)(days - days_from_civil(january_first)) + 1;
+    int week = (day_of_year - (weekday_from_days(days) + 1) + 10) / 7;
+    int year = date.year;
+
+    if (week < 1) {
+        year--;
+        week = iso_weeks_in_year(year);
+    } else if (week > iso_weeks_in_year(year)) {
+        year++;
+        week = 1;
+    }
+
+    if (iso_year) *iso_year = year;
+    return week;
+}
+
+int freeslots_compare_dates(FreeSlotsDate date1, FreeSlotsDate date2) {
+    return compare_dates(date1, date2);
+}
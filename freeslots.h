@@ -0,0 +1,258 @@
+#ifndef FREESLOTS_H
+#define FREESLOTS_H
+
+#include <stddef.h>
+
+#include "pool.h"
+
+// libfreeslots: merge busy intervals from many calendars and report the free
+// slots inside a daily window.
+//
+// All state lives in the store handle. Calendars are created from one thread;
+// different calendars may then be filled from different threads. Once
+// freeslots_store_build_index has returned, any number of threads may run
+// queries against the store concurrently. Nothing is written to
+// stdout or stderr; diagnostics and results are delivered through callbacks.
+
+typedef struct FreeSlotsStore FreeSlotsStore;
+typedef struct FreeSlotsSweep FreeSlotsSweep;
+typedef struct FreeSlotsBusyIndex FreeSlotsBusyIndex;
+
+typedef struct {
+    int year;
+    int month;
+    int day;
+} FreeSlotsDate;
+
+typedef struct {
+    int window_start_minutes;
+    int window_end_minutes;
+    int minimum_slot_minutes;
+} FreeSlotsConfig;
+
+// One busy row as it appears in a calendar export. Rows that span several
+// days are split into one busy interval per day.
+typedef struct {
+    FreeSlotsDate start_date;
+    int start_minutes;
+    FreeSlotsDate end_date;
+    int end_minutes;
+} FreeSlotsEvent;
+
+// Called once for each day a query visits, ahead of that day's slots: every
+// day in range on which a selected calendar is busy, including days left
+// without a slot. It gets the slot callback's user_data.
+typedef void (*FreeSlotsDayCallback)(int query, FreeSlotsDate date,
+                                     void *user_data);
+
+// A zeroed `from` or `to` leaves that end of the date range open. A NULL
+// `calendars` selects every calendar in the store. `on_day` may be NULL.
+typedef struct {
+    FreeSlotsConfig config;
+    FreeSlotsDate from;
+    FreeSlotsDate to;
+    const int *calendars;
+    int calendar_count;
+    FreeSlotsDayCallback on_day;
+} FreeSlotsQuery;
+
+typedef struct {
+    int query;
+    FreeSlotsDate date;
+    int start_minutes;
+    int end_minutes;
+} FreeSlotsSlot;
+
+typedef void (*FreeSlotsSlotCallback)(const FreeSlotsSlot *slot,
+                                      void *user_data);
+
+typedef void (*FreeSlotsEventCallback)(const FreeSlotsEvent *event,
+                                       void *user_data);
+
+// Called for every CSV row that is skipped. `field` is the offending field,
+// or NULL when the row did not have enough fields.
+typedef void (*FreeSlotsSkipCallback)(int line_number, const char *reason,
+                                      const char *field, void *user_data);
+
+// Marks the start (`is_end` 0) and end (`is_end` 1) of a unit of internal
+// work, such as sorting one run or answering one range of days, so callers
+// can draw timelines. Both calls come from the thread that did the work, and
+// spans on a thread nest. At the end, `count` is the number of items handled.
+typedef void (*FreeSlotsSpanCallback)(const char *name, int is_end,
+                                      long count, void *user_data);
+
+FreeSlotsStore *freeslots_store_create(void);
+void freeslots_store_destroy(FreeSlotsStore *store);
+
+// Returns the id of a new, empty calendar.
+int freeslots_store_add_calendar(FreeSlotsStore *store);
+
+// Parses a TimeEdit CSV export (start_date,start_time,end_date,end_time) into
+// the given calendar. `on_skip` may be NULL. Returns 0 on a bad calendar id.
+int freeslots_store_add_csv(FreeSlotsStore *store, int calendar,
+                            const char *data, size_t size,
+                            FreeSlotsSkipCallback on_skip, void *user_data);
+
+int freeslots_store_add_event(FreeSlotsStore *store, int calendar,
+                              const FreeSlotsEvent *event);
+
+// Sorts and merges every calendar that changed since the last call. Must be
+// called before querying.
+int freeslots_store_build_index(FreeSlotsStore *store);
+
+// Same as freeslots_store_build_index, but normalizes calendars as separate
+// pool tasks and sorts large calendars in parallel runs.
+int freeslots_store_build_index_parallel(FreeSlotsStore *store,
+                                         FreeSlotsPool *pool);
+
+// Reports sorting, merging and parallel query ranges through `on_span`. Set it
+// before building the index; the callback must be safe to call from pool
+// threads.
+void freeslots_store_set_span_callback(FreeSlotsStore *store,
+                                       FreeSlotsSpanCallback on_span,
+                                       void *user_data);
+
+// Parses, merges and queries the store with the kernels for the named
+// instruction set rather than the widest the CPU supports (see
+// freeslots_isa). Returns 0 if the name is unknown or the CPU lacks it.
+int freeslots_store_set_isa(FreeSlotsStore *store, const char *isa);
+
+int freeslots_store_calendar_count(const FreeSlotsStore *store);
+
+// Per-day busy intervals added so far, before merging.
+long freeslots_store_event_count(const FreeSlotsStore *store);
+
+// Disjoint busy intervals kept by the index.
+long freeslots_store_busy_count(const FreeSlotsStore *store);
+
+// Valid rows added so far, before multi-day rows are split.
+long freeslots_store_row_count(const FreeSlotsStore *store);
+
+// Busy intervals that an earlier calendar also has on the same day, as when
+// students share their lectures; a merge that includes the earlier calendar
+// skips them. Returns -1 if the store is not indexed.
+long freeslots_store_duplicate_count(const FreeSlotsStore *store);
+
+// Days with at least one busy interval in any calendar, or -1 if the store is
+// not indexed.
+long freeslots_store_day_count(const FreeSlotsStore *store);
+
+// Streams the free slots of one query in date order. Returns 0 if the store
+// is not indexed or the query names an unknown calendar.
+int freeslots_query(const FreeSlotsStore *store, const FreeSlotsQuery *query,
+                    FreeSlotsSlotCallback on_slot, void *user_data);
+
+// Like freeslots_query, but splits the days into ranges that are answered as
+// pool tasks. Slots are still delivered in date order, from the calling
+// thread, once every range is done.
+int freeslots_query_parallel(const FreeSlotsStore *store,
+                             const FreeSlotsQuery *query, FreeSlotsPool *pool,
+                             FreeSlotsSlotCallback on_slot, void *user_data);
+
+// Like freeslots_query, but writes up to `capacity` slots into `slots`, and
+// without calling `on_day`. Returns the total number of slots, which may
+// exceed `capacity`, or -1 on error.
+long freeslots_query_to_buffer(const FreeSlotsStore *store,
+                               const FreeSlotsQuery *query,
+                               FreeSlotsSlot *slots, long capacity);
+
+// Answers many queries in a single sweep over the days. Queries that select
+// the same calendars share one merge per day. Slots arrive in date order,
+// tagged with the index of their query.
+int freeslots_query_batch(const FreeSlotsStore *store,
+                          const FreeSlotsQuery *queries, int query_count,
+                          FreeSlotsSlotCallback on_slot, void *user_data);
+
+// A busy index keeps, for each day, the merged busy intervals of a set of
+// calendars and a running sum of their busy minutes, so the busy or free time
+// inside any window over any range of days takes binary searches and
+// subtractions rather than merging the calendars again. It is a snapshot:
+// events added to the store later are not seen.
+//
+// Returns NULL if the store is not indexed or a calendar is unknown. A NULL
+// `calendars` selects every calendar in the store.
+FreeSlotsBusyIndex *freeslots_busy_index_create(const FreeSlotsStore *store,
+                                                const int *calendars,
+                                                int calendar_count);
+void freeslots_busy_index_destroy(FreeSlotsBusyIndex *index);
+
+// Busy minutes inside [window_start_minutes, window_end_minutes) on `date`.
+int freeslots_busy_index_busy_minutes(const FreeSlotsBusyIndex *index,
+                                      FreeSlotsDate date,
+                                      int window_start_minutes,
+                                      int window_end_minutes);
+
+// Busy minutes inside the window summed over the days from `from` to `to`,
+// both included; a zeroed date leaves that end open. The whole-day window
+// takes constant time after the two searches, others a search per busy day.
+long freeslots_busy_index_busy_range(const FreeSlotsBusyIndex *index,
+                                     FreeSlotsDate from, FreeSlotsDate to,
+                                     int window_start_minutes,
+                                     int window_end_minutes);
+
+// The first and last day with busy time. Returns 0 if there is none.
+int freeslots_busy_index_days(const FreeSlotsBusyIndex *index,
+                              FreeSlotsDate *first, FreeSlotsDate *last);
+
+// Parses CSV rows without storing them, numbering lines from
+// `first_line_number`. Returns the number of lines consumed so that a caller
+// splitting a file into blocks can keep line numbers continuous. `isa` names
+// the kernels to parse with, as for freeslots_store_set_isa; NULL, or one
+// the CPU lacks, picks the widest supported.
+int freeslots_parse_csv(const char *data, size_t size, int first_line_number,
+                        const char *isa, FreeSlotsEventCallback on_event,
+                        FreeSlotsSkipCallback on_skip, void *user_data);
+
+// A sweep computes free slots over a stream of rows sorted by start date. It
+// emits each day as soon as no later row can reach it, so memory stays
+// bounded by the days still open.
+FreeSlotsSweep *freeslots_sweep_create(FreeSlotsConfig config,
+                                       FreeSlotsSlotCallback on_slot,
+                                       void *user_data);
+
+// Returns 0, without adding the row, if it starts before an earlier row.
+int freeslots_sweep_add_event(FreeSlotsSweep *sweep,
+                              const FreeSlotsEvent *event);
+
+// Has the sweep report each day it completes, as a query's `on_day` does,
+// with query 0.
+void freeslots_sweep_set_day_callback(FreeSlotsSweep *sweep,
+                                      FreeSlotsDayCallback on_day);
+
+// As freeslots_store_set_isa, for the sweep's merging.
+int freeslots_sweep_set_isa(FreeSlotsSweep *sweep, const char *isa);
+
+// Emits the days that are still open. Call once after the last row.
+void freeslots_sweep_finish(FreeSlotsSweep *sweep);
+
+long freeslots_sweep_event_count(const FreeSlotsSweep *sweep);
+void freeslots_sweep_destroy(FreeSlotsSweep *sweep);
+
+// Parses "HH:MM" into minutes after midnight, or returns -1.
+int freeslots_parse_time(const char *time_str);
+
+// Parses "YYYY-MM-DD". Returns 1 on success, or 0 for a malformed date or
+// one past the end of its month, such as 2025-02-30.
+int freeslots_parse_date(const char *date_str, FreeSlotsDate *date);
+
+int freeslots_compare_dates(FreeSlotsDate date1, FreeSlotsDate date2);
+
+// Widest instruction set the CPU supports for the vectorized parsing and
+// merging kernels: "scalar", "sse2", "sse4.2", "avx2" or "avx512". Stores and
+// sweeps use it unless given another one.
+const char *freeslots_isa(void);
+
+// Returns 1 if the name is one of the above and the CPU supports it.
+int freeslots_isa_supported(const char *isa);
+
+// The date `days` days later, or earlier for a negative count.
+FreeSlotsDate freeslots_add_days(FreeSlotsDate date, int days);
+
+// Day of the week, 0 for Monday through 6 for Sunday.
+int freeslots_weekday(FreeSlotsDate date);
+
+// ISO 8601 week number, 1 to 53. `iso_year`, if not NULL, receives the year
+// the week belongs to, which differs from the date's around New Year.
+int freeslots_iso_week(FreeSlotsDate date, int *iso_year);
+
+#endif  // FREESLOTS_H
@@ -0,0 +1,288 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+    int year;
+    int month;
+    int day;
+} Date;
+
+typedef struct {
+    Date start_date;
+    int start_minutes;
+    Date end_date;
+    int end_minutes;
+} Row;
+
+typedef struct {
+    int calendars;
+    int years;
+    int events_per_day;
+    double multi_day_fraction;
+    double duplicate_rate;
+    double unsorted_fraction;
+    uint64_t seed;
+    Date start;
+    const char *output_dir;
+} GeneratorConfig;
+
+uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+double next_unit(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int next_below(uint64_t *state, int bound) {
+    return (int)(next_random(state) % (uint64_t)bound);
+}
+
+int is_leap_year(int year) {
+    return (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+}
+
+int days_in_month(int year, int month) {
+    int days_per_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    if (month == 2 && is_leap_year(year)) {
+        return 29;
+    }
+    return days_per_month[month - 1];
+}
+
+Date next_date(Date date) {
+    date.day++;
+    if (date.day > days_in_month(date.year, date.month)) {
+        date.day = 1;
+        date.month++;
+        if (date.month > 12) {
+            date.month = 1;
+            date.year++;
+        }
+    }
+    return date;
+}
+
+// Zeller-style weekday, 0 = Monday.
+int weekday(Date date) {
+    int year = date.year;
+    int month = date.month;
+    if (month < 3) {
+        month += 12;
+        year--;
+    }
+    int h = (date.day + 13 * (month + 1) / 5 + year + year / 4 - year / 100 +
+             year / 400) %
+            7;
+    return (h + 5) % 7;
+}
+
+// A lecture-shaped row: quarter-hour aligned between 08:00 and 20:00, 45 to
+// 180 minutes long, occasionally running over into the following days.
+Row random_row(uint64_t *state, Date date, double multi_day_fraction) {
+    Row row;
+    row.start_date = date;
+    row.end_date = date;
+    row.start_minutes = 8 * 60 + 15 * next_below(state, 40);
+    row.end_minutes = row.start_minutes + 45 + 15 * next_below(state, 10);
+    if (row.end_minutes > 24 * 60) row.end_minutes = 24 * 60;
+
+    if (next_unit(state) < multi_day_fraction) {
+        int extra_days = 1 + next_below(state, 3);
+        for (int i = 0; i < extra_days; i++) {
+            row.end_date = next_date(row.end_date);
+        }
+        row.end_minutes = 15 * next_below(state, 96);
+    }
+
+    return row;
+}
+
+void write_row(FILE *file, const Row *row) {
+    fprintf(file, "%04d-%02d-%02d,%02d:%02d,%04d-%02d-%02d,%02d:%02d\n",
+            row->start_date.year, row->start_date.month, row->start_date.day,
+            row->start_minutes / 60, row->start_minutes % 60,
+            row->end_date.year, row->end_date.month, row->end_date.day,
+            row->end_minutes / 60, row->end_minutes % 60);
+}
+
+int parse_date(const char *str, Date *date) {
+    return sscanf(str, "%4d-%2d-%2d", &date->year, &date->month,
+                  &date->day) == 3 &&
+           date->month >= 1 && date->month <= 12 && date->day >= 1 &&
+           date->day <= days_in_month(date->year, date->month);
+}
+
+long generate_calendars(const GeneratorConfig *config) {
+    int day_count = 0;
+    Date end = config->start;
+    end.year += config->years;
+    for (Date d = config->start;
+         d.year != end.year || d.month != end.month || d.day != end.day;
+         d = next_date(d)) {
+        day_count++;
+    }
+
+    // Rows shared by the whole cohort for each day; a duplicate is drawn from
+    // here so identical lectures show up across (and within) calendars.
+    Row *cohort = malloc(sizeof(Row) * ((size_t)config->events_per_day + 1));
+    Row *rows = NULL;
+    long capacity = 0;
+    long total_rows = 0;
+
+    for (int c = 0; c < config->calendars; c++) {
+        uint64_t state = config->seed * 1000003ull + (uint64_t)c;
+        long row_count = 0;
+        Date date = config->start;
+
+        for (int d = 0; d < day_count; d++, date = next_date(date)) {
+            if (weekday(date) >= 5) continue;
+
+            uint64_t cohort_state = config->seed * 7919ull + (uint64_t)d;
+            for (int e = 0; e < config->events_per_day; e++) {
+                cohort[e] = random_row(&cohort_state, date,
+                                       config->multi_day_fraction);
+            }
+
+            for (int e = 0; e < config->events_per_day; e++) {
+                if (row_count >= capacity) {
+                    capacity = capacity ? capacity * 2 : 4096;
+                    rows = realloc(rows, sizeof(Row) * capacity);
+                }
+
+                if (next_unit(&state) < config->duplicate_rate) {
+                    rows[row_count++] =
+                        cohort[next_below(&state, config->events_per_day)];
+                } else {
+                    rows[row_count++] = random_row(
+                        &state, date, config->multi_day_fraction);
+                }
+            }
+        }
+
+        long swaps = (long)(config->unsorted_fraction * row_count / 2);
+        for (long i = 0; i < swaps; i++) {
+            long a = next_random(&state) % row_count;
+            long b = next_random(&state) % row_count;
+            Row swap = rows[a];
+            rows[a] = rows[b];
+            rows[b] = swap;
+        }
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/cal%05d.csv", config->output_dir, c);
+        FILE *file = fopen(path, "w");
+        if (!file) {
+            fprintf(stderr, "Cannot open file: %s\n", path);
+            free(rows);
+            free(cohort);
+            return -1;
+        }
+        for (long i = 0; i < row_count; i++) {
+            write_row(file, &rows[i]);
+        }
+        fclose(file);
+
+        total_rows += row_count;
+    }
+
+    free(rows);
+    free(cohort);
+    return total_rows;
+}
+
+void print_usage(const char *program_name) {
+    fprintf(stderr,
+            "Usage: %s [options] OUTPUT_DIR\n\n"
+            "Writes deterministic TimeEdit-style calendars "
+            "OUTPUT_DIR/calNNNNN.csv.\n\n"
+            "Options:\n"
+            "  --calendars N       Number of calendar files (default: 3)\n"
+            "  --years N           Years covered from the start date "
+            "(default: 1)\n"
+            "  --events-per-day N  Rows per calendar and weekday (default: 4)\n"
+            "  --multi-day F       Fraction of rows spanning days "
+            "(default: 0.01)\n"
+            "  --duplicates F      Fraction of rows copied from the shared "
+            "cohort\n"
+            "                      schedule (default: 0.5)\n"
+            "  --unsorted F        Fraction of rows moved out of date order "
+            "(default: 0)\n"
+            "  --start YYYY-MM-DD  First day (default: 2025-01-01)\n"
+            "  --seed N            Random seed (default: 1)\n",
+            program_name);
+}
+
+int main(int argc, char *argv[]) {
+    GeneratorConfig config = {.calendars = 3,
+                              .years = 1,
+                              .events_per_day = 4,
+                              .multi_day_fraction = 0.01,
+                              .duplicate_rate = 0.5,
+                              .unsorted_fraction = 0.0,
+                              .seed = 1,
+                              .start = {2025, 1, 1}};
+
+    int arg_index = 1;
+    while (arg_index < argc && argv[arg_index][0] == '-') {
+        if (arg_index + 1 >= argc) {
+            fprintf(stderr, "Error: %s option requires an argument\n",
+                    argv[arg_index]);
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        const char *option = argv[arg_index];
+        const char *value = argv[arg_index + 1];
+
+        if (strcmp(option, "--calendars") == 0) {
+            config.calendars = atoi(value);
+        } else if (strcmp(option, "--years") == 0) {
+            config.years = atoi(value);
+        } else if (strcmp(option, "--events-per-day") == 0) {
+            config.events_per_day = atoi(value);
+        } else if (strcmp(option, "--multi-day") == 0) {
+            config.multi_day_fraction = atof(value);
+        } else if (strcmp(option, "--duplicates") == 0) {
+            config.duplicate_rate = atof(value);
+        } else if (strcmp(option, "--unsorted") == 0) {
+            config.unsorted_fraction = atof(value);
+        } else if (strcmp(option, "--seed") == 0) {
+            config.seed = strtoull(value, NULL, 10);
+        } else if (strcmp(option, "--start") == 0) {
+            if (!parse_date(value, &config.start)) {
+                fprintf(stderr, "Error: Invalid start date %s\n", value);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Error: Unknown option %s\n", option);
+            print_usage(argv[0]);
+            return 1;
+        }
+        arg_index += 2;
+    }
+
+    if (arg_index != argc - 1 || config.calendars < 1 || config.years < 1 ||
+        config.events_per_day < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    config.output_dir = argv[arg_index];
+    mkdir(config.output_dir, 0755);
+
+    long rows = generate_calendars(&config);
+    if (rows < 0) return 1;
+
+    printf("%ld\n", rows);
+    return 0;
+}
@@ -0,0 +1,310 @@
+#include "kernels.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86
+#endif
+
+int clamp_filter_scalar(const int *starts, const int *ends, int count,
+                        int window_start, int window_end, int *out_starts,
+                        int *out_ends) {
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        int start = starts[i] < window_start ? window_start : starts[i];
+        int end = ends[i] > window_end ? window_end : ends[i];
+        int keep = ends[i] > window_start && starts[i] < window_end;
+
+        // Always store and only advance on a keeper, so there is no branch
+        // to mispredict.
+        out_starts[kept] = start;
+        out_ends[kept] = end;
+        kept += keep;
+    }
+    return kept;
+}
+
+size_t field_end_scalar(const char *text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        if (c == ',' || c == '\r' || c == '\n' || c == '\0') return i;
+    }
+    return length;
+}
+
+static int is_digit(char c) { return c >= '0' && c <= '9'; }
+
+int parse_date_field_scalar(const char *field, FreeSlotsDate *date) {
+    static const int digit_positions[8] = {0, 1, 2, 3, 5, 6, 8, 9};
+    if (field[4] != '-' || field[7] != '-' || field[10] != '\0') return 0;
+    for (int i = 0; i < 8; i++) {
+        if (!is_digit(field[digit_positions[i]])) return 0;
+    }
+
+    date->year = (field[0] - '0') * 1000 + (field[1] - '0') * 100 +
+                 (field[2] - '0') * 10 + (field[3] - '0');
+    date->month = (field[5] - '0') * 10 + (field[6] - '0');
+    date->day = (field[8] - '0') * 10 + (field[9] - '0');
+    return date->month >= 1 && date->month <= 12 && date->day >= 1 &&
+           date->day <= 31;
+}
+
+#ifdef KERNELS_X86
+
+// SSE2 has neither 32-bit min/max nor a variable shuffle, so the clamp is a
+// compare-and-select and the surviving lanes are copied out one by one.
+int clamp_filter_sse2(const int *starts, const int *ends, int count,
+                      int window_start, int window_end, int *out_starts,
+                      int *out_ends) {
+    __m128i low = _mm_set1_epi32(window_start);
+    __m128i high = _mm_set1_epi32(window_end);
+    int kept = 0;
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i start = _mm_loadu_si128((const __m128i *)(starts + i));
+        __m128i end = _mm_loadu_si128((const __m128i *)(ends + i));
+
+        __m128i below = _mm_cmpgt_epi32(low, start);
+        __m128i above = _mm_cmpgt_epi32(end, high);
+        __m128i keep = _mm_and_si128(_mm_cmpgt_epi32(end, low),
+                                     _mm_cmpgt_epi32(high, start));
+        start = _mm_or_si128(_mm_and_si128(below, low),
+                             _mm_andnot_si128(below, start));
+        end = _mm_or_si128(_mm_and_si128(above, high),
+                           _mm_andnot_si128(above, end));
+
+        int32_t clamped_starts[4], clamped_ends[4];
+        _mm_storeu_si128((__m128i *)clamped_starts, start);
+        _mm_storeu_si128((__m128i *)clamped_ends, end);
+
+        unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(keep));
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            out_starts[kept] = clamped_starts[lane];
+            out_ends[kept] = clamped_ends[lane];
+            kept++;
+            mask &= mask - 1;
+        }
+    }
+
+    return kept + clamp_filter_scalar(starts + i, ends + i, count - i,
+                                      window_start, window_end,
+                                      out_starts + kept, out_ends + kept);
+}
+
+// For every 8-bit keep mask, the lanes to keep packed to the front, three
+// bits per lane: a kept lane goes to the slot given by the kept lanes below.
+#define KEPT_BELOW(mask, lane)                                                 \
+    __builtin_popcount((mask) & ((1u << (lane)) - 1))
+#define KEEP_LANE(mask, lane)                                                  \
+    ((mask) >> (lane) & 1                                                      \
+         ? (uint32_t)(lane) << (3 * KEPT_BELOW(mask, lane))                    \
+         : 0)
+#define COMPRESS_LANES(m)                                                      \
+    (KEEP_LANE(m, 0) | KEEP_LANE(m, 1) | KEEP_LANE(m, 2) | KEEP_LANE(m, 3) |   \
+     KEEP_LANE(m, 4) | KEEP_LANE(m, 5) | KEEP_LANE(m, 6) | KEEP_LANE(m, 7))
+#define COMPRESS_LANES_4(m)                                                    \
+    COMPRESS_LANES(m), COMPRESS_LANES(m + 1), COMPRESS_LANES(m + 2),           \
+        COMPRESS_LANES(m + 3)
+#define COMPRESS_LANES_16(m)                                                   \
+    COMPRESS_LANES_4(m), COMPRESS_LANES_4(m + 4), COMPRESS_LANES_4(m + 8),     \
+        COMPRESS_LANES_4(m + 12)
+#define COMPRESS_LANES_64(m)                                                   \
+    COMPRESS_LANES_16(m), COMPRESS_LANES_16(m + 16),                           \
+        COMPRESS_LANES_16(m + 32), COMPRESS_LANES_16(m + 48)
+
+static const uint32_t compress_lanes[256] = {
+    COMPRESS_LANES_64(0), COMPRESS_LANES_64(64), COMPRESS_LANES_64(128),
+    COMPRESS_LANES_64(192)};
+
+// AVX2 has no compress-store, so the kept lanes are permuted to the front and
+// the whole register is stored; the next store overwrites the leftovers.
+__attribute__((target("avx2"))) int clamp_filter_avx2(
+    const int *starts, const int *ends, int count, int window_start,
+    int window_end, int *out_starts, int *out_ends) {
+    __m256i low = _mm256_set1_epi32(window_start);
+    __m256i high = _mm256_set1_epi32(window_end);
+    __m256i lane_shifts = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    __m256i lane_bits = _mm256_set1_epi32(7);
+    int kept = 0;
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i start = _mm256_loadu_si256((const __m256i *)(starts + i));
+        __m256i end = _mm256_loadu_si256((const __m256i *)(ends + i));
+
+        __m256i keep = _mm256_and_si256(_mm256_cmpgt_epi32(end, low),
+                                        _mm256_cmpgt_epi32(high, start));
+        start = _mm256_max_epi32(start, low);
+        end = _mm256_min_epi32(end, high);
+
+        unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(keep));
+        __m256i lanes = _mm256_and_si256(
+            _mm256_srlv_epi32(_mm256_set1_epi32(compress_lanes[mask]),
+                              lane_shifts),
+            lane_bits);
+        _mm256_storeu_si256((__m256i *)(out_starts + kept),
+                            _mm256_permutevar8x32_epi32(start, lanes));
+        _mm256_storeu_si256((__m256i *)(out_ends + kept),
+                            _mm256_permutevar8x32_epi32(end, lanes));
+        kept += __builtin_popcount(mask);
+    }
+
+    return kept + clamp_filter_scalar(starts + i, ends + i, count - i,
+                                      window_start, window_end,
+                                      out_starts + kept, out_ends + kept);
+}
+
+// pcmpestri compares a whole block against the four delimiters at once.
+// Fields are mostly under 16 bytes, so wider registers only add tail work and
+// the AVX2 and AVX-512 kernel sets use this scanner too.
+__attribute__((target("sse4.2"))) size_t field_end_sse42(const char *text,
+                                                         size_t length) {
+    const __m128i delimiters = _mm_setr_epi8(',', '\r', '\n', '\0', 0, 0, 0, 0,
+                                             0, 0, 0, 0, 0, 0, 0, 0);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+        int index = _mm_cmpestri(delimiters, 4, chunk, 16,
+                                 _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+                                     _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16) return i + index;
+    }
+    return i + field_end_scalar(text + i, length - i);
+}
+
+// One 16-byte load covers the whole field. The eight digits are gathered to
+// the front and paired up with multiply-adds into the two halves of the year,
+// the month and the day.
+__attribute__((target("sse4.2"))) int parse_date_field_sse42(
+    const char *field, FreeSlotsDate *date) {
+    const __m128i shape = _mm_setr_epi8('0', '0', '0', '0', '-', '0', '0', '-',
+                                        '0', '0', 0, 0, 0, 0, 0, 0);
+    const __m128i digit_order =
+        _mm_setr_epi8(0, 1, 2, 3, 5, 6, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i tens = _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 0, 0, 0, 0,
+                                       0, 0, 0, 0);
+
+    __m128i text = _mm_loadu_si128((const __m128i *)field);
+    __m128i non_digits =
+        _mm_or_si128(_mm_cmplt_epi8(text, _mm_set1_epi8('0')),
+                     _mm_cmpgt_epi8(text, _mm_set1_epi8('9')));
+    __m128i separators = _mm_cmpeq_epi8(text, shape);
+
+    // Digits at 0-3, 5-6 and 8-9; '-' at 4 and 7 and the NUL at 10.
+    if (_mm_movemask_epi8(non_digits) & 0x36f) return 0;
+    if ((_mm_movemask_epi8(separators) & 0x490) != 0x490) return 0;
+
+    __m128i digits = _mm_sub_epi8(text, _mm_set1_epi8('0'));
+    __m128i pairs =
+        _mm_maddubs_epi16(_mm_shuffle_epi8(digits, digit_order), tens);
+
+    date->year =
+        _mm_extract_epi16(pairs, 0) * 100 + _mm_extract_epi16(pairs, 1);
+    date->month = _mm_extract_epi16(pairs, 2);
+    date->day = _mm_extract_epi16(pairs, 3);
+    return date->month >= 1 && date->month <= 12 && date->day >= 1 &&
+           date->day <= 31;
+}
+
+// AVX-512 compresses the kept lanes itself. Full blocks compress into a
+// register that is stored whole; the tail uses masked loads and a compress
+// store that writes only the kept lanes.
+__attribute__((target("avx512f"))) int clamp_filter_avx512(
+    const int *starts, const int *ends, int count, int window_start,
+    int window_end, int *out_starts, int *out_ends) {
+    __m512i low = _mm512_set1_epi32(window_start);
+    __m512i high = _mm512_set1_epi32(window_end);
+    int kept = 0;
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m512i start = _mm512_loadu_si512(starts + i);
+        __m512i end = _mm512_loadu_si512(ends + i);
+
+        __mmask16 keep = _mm512_cmpgt_epi32_mask(end, low) &
+                         _mm512_cmplt_epi32_mask(start, high);
+        _mm512_storeu_si512(out_starts + kept,
+                            _mm512_maskz_compress_epi32(
+                                keep, _mm512_max_epi32(start, low)));
+        _mm512_storeu_si512(out_ends + kept,
+                            _mm512_maskz_compress_epi32(
+                                keep, _mm512_min_epi32(end, high)));
+        kept += __builtin_popcount(keep);
+    }
+
+    if (i < count) {
+        __mmask16 loaded = (1u << (count - i)) - 1;
+        __m512i start = _mm512_maskz_loadu_epi32(loaded, starts + i);
+        __m512i end = _mm512_maskz_loadu_epi32(loaded, ends + i);
+
+        __mmask16 keep = _mm512_cmpgt_epi32_mask(end, low) &
+                         _mm512_cmplt_epi32_mask(start, high) & loaded;
+        _mm512_mask_compressstoreu_epi32(out_starts + kept, keep,
+                                         _mm512_max_epi32(start, low));
+        _mm512_mask_compressstoreu_epi32(out_ends + kept, keep,
+                                         _mm512_min_epi32(end, high));
+        kept += __builtin_popcount(keep);
+    }
+
+    return kept;
+}
+
+#endif
+
+// Kernel variants per instruction set, from narrowest to widest. Other CPUs,
+// ARM included, have only the scalar kernels.
+static const KernelSet kernel_sets[] = {
+    {"scalar", clamp_filter_scalar, field_end_scalar, parse_date_field_scalar},
+#ifdef KERNELS_X86
+    {"sse2", clamp_filter_sse2, field_end_scalar, parse_date_field_scalar},
+    {"sse4.2", clamp_filter_sse2, field_end_sse42, parse_date_field_sse42},
+    {"avx2", clamp_filter_avx2, field_end_sse42, parse_date_field_sse42},
+    {"avx512", clamp_filter_avx512, field_end_sse42, parse_date_field_sse42},
+#endif
+};
+
+#define KERNEL_SET_COUNT (int)(sizeof(kernel_sets) / sizeof(kernel_sets[0]))
+
+static int is_isa_supported(const char *isa) {
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (strcmp(isa, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(isa, "sse4.2") == 0) return __builtin_cpu_supports("sse4.2");
+    if (strcmp(isa, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(isa, "avx512") == 0) {
+        return __builtin_cpu_supports("avx512f");
+    }
+#endif
+    (void)isa;
+    return 1;
+}
+
+static pthread_once_t widest_resolved = PTHREAD_ONCE_INIT;
+static const KernelSet *widest_set;
+
+static void resolve_widest(void) {
+    int widest = KERNEL_SET_COUNT - 1;
+    while (widest > 0 && !is_isa_supported(kernel_sets[widest].isa)) widest--;
+    widest_set = &kernel_sets[widest];
+}
+
+const KernelSet *kernels_default(void) {
+    pthread_once(&widest_resolved, resolve_widest);
+    return widest_set;
+}
+
+const KernelSet *kernels_for_isa(const char *isa) {
+    if (!isa) return kernels_default();
+
+    for (int i = 0; i < KERNEL_SET_COUNT; i++) {
+        if (strcmp(kernel_sets[i].isa, isa) == 0) {
+            return is_isa_supported(isa) ? &kernel_sets[i] : NULL;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,67 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+
+#include "freeslots.h"
+
+// Inner loops of libfreeslots that have vectorized variants, grouped into one
+// immutable KernelSet per instruction set. The CPU is probed once for the
+// widest set it supports; a store or sweep may be given a narrower one. Sets
+// without a variant of some kernel use the next narrower one they have.
+
+// Clamps the intervals [starts[i], ends[i]) to [window_start, window_end)
+// and writes the ones that still overlap the window, in order, to the output
+// columns. Returns how many were written. The output may alias the input;
+// vector variants store whole registers, but never past the input count.
+typedef int (*ClampFilterKernel)(const int *starts, const int *ends,
+                                 int count, int window_start, int window_end,
+                                 int *out_starts, int *out_ends);
+
+// Returns the index of the first ',', '\r', '\n' or NUL in text[0, length),
+// or length when there is none.
+typedef size_t (*FieldEndKernel)(const char *text, size_t length);
+
+// Parses a field of exactly the form YYYY-MM-DD with a valid month and day.
+// The field must sit in a buffer with at least 16 readable bytes. Returns 0,
+// leaving the date unspecified, for anything else, which the caller then
+// hands to the lenient scalar parser.
+typedef int (*DateFieldKernel)(const char *field, FreeSlotsDate *date);
+
+typedef struct {
+    const char *isa;
+    ClampFilterKernel clamp_filter;
+    FieldEndKernel field_end;
+    DateFieldKernel parse_date_field;
+} KernelSet;
+
+// The individual variants, for benchmarks. The vector ones must only be
+// called on CPUs that support them.
+int clamp_filter_scalar(const int *starts, const int *ends, int count,
+                        int window_start, int window_end, int *out_starts,
+                        int *out_ends);
+size_t field_end_scalar(const char *text, size_t length);
+int parse_date_field_scalar(const char *field, FreeSlotsDate *date);
+#if defined(__x86_64__) || defined(__i386__)
+int clamp_filter_sse2(const int *starts, const int *ends, int count,
+                      int window_start, int window_end, int *out_starts,
+                      int *out_ends);
+int clamp_filter_avx2(const int *starts, const int *ends, int count,
+                      int window_start, int window_end, int *out_starts,
+                      int *out_ends);
+int clamp_filter_avx512(const int *starts, const int *ends, int count,
+                        int window_start, int window_end, int *out_starts,
+                        int *out_ends);
+size_t field_end_sse42(const char *text, size_t length);
+int parse_date_field_sse42(const char *field, FreeSlotsDate *date);
+#endif
+
+// The set for the widest instruction set the CPU supports ("scalar", "sse2",
+// "sse4.2", "avx2" or "avx512"), probed on the first call.
+const KernelSet *kernels_default(void);
+
+// The set for the named instruction set, or the default one for NULL.
+// Returns NULL when the name is unknown or the CPU does not support it.
+const KernelSet *kernels_for_isa(const char *isa);
+
+#endif  // KERNELS_H
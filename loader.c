@@ -0,0 +1,451 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "loader.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define LOADER_HAS_IO_URING
+#endif
+#endif
+
+// Files being read at once. A file never has more than two operations queued
+// or in flight, so the ring has room for all of them.
+#define LOADER_FILES_IN_FLIGHT 64
+#define LOADER_RING_ENTRIES (2 * LOADER_FILES_IN_FLIGHT)
+
+// Buffer for a file whose size could not be looked up.
+#define LOADER_DEFAULT_CAPACITY (64 * 1024)
+
+// One file on its way through the loader. Freed once it has been parsed.
+typedef struct {
+    const char *path;
+    LoadedFile file;
+    LoadedFileCallback on_file;
+    void *user_data;
+} LoadTask;
+
+static void parse_loaded_file(void *arg) {
+    LoadTask *task = arg;
+    task->on_file(&task->file, task->user_data);
+    free(task);
+}
+
+// Reads from the start until a read returns nothing. Sizing the buffer one
+// byte past the reported size makes that last read land in spare room. Pipes
+// cannot be read at an offset and are read in sequence instead.
+static int pread_whole_file(int fd, char **data, size_t *size) {
+    struct stat st;
+    size_t capacity = fstat(fd, &st) == 0 && st.st_size > 0
+                          ? (size_t)st.st_size + 1
+                          : LOADER_DEFAULT_CAPACITY;
+    *data = malloc(capacity);
+    *size = 0;
+
+    for (;;) {
+        ssize_t bytes_read = pread(fd, *data + *size, capacity - *size, *size);
+        if (bytes_read < 0 && errno == ESPIPE) {
+            bytes_read = read(fd, *data + *size, capacity - *size);
+        }
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            free(*data);
+            *data = NULL;
+            return 0;
+        }
+        if (bytes_read == 0) return 1;
+
+        *size += bytes_read;
+        if (*size == capacity) {
+            capacity *= 2;
+            *data = realloc(*data, capacity);
+        }
+    }
+}
+
+static void pread_and_parse_task(void *arg) {
+    LoadTask *task = arg;
+    double started = stats_now();
+
+    int fd = open(task->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open file: %s\n", task->path);
+    } else {
+        if (!pread_whole_file(fd, &task->file.data, &task->file.size)) {
+            fprintf(stderr, "Cannot read file: %s\n", task->path);
+        }
+        close(fd);
+    }
+
+    task->file.read_seconds = stats_now() - started;
+    parse_loaded_file(task);
+}
+
+#ifdef LOADER_HAS_IO_URING
+
+typedef struct {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    // Entries queued since the last io_uring_enter.
+    unsigned queued;
+} Ring;
+
+static int ring_open(Ring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return 0;
+
+    // Opening, statx and plain reads arrived with this flag in Linux 5.6.
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring->fd);
+        return 0;
+    }
+
+    ring->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes +
+                         params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single_mmap
+                        ? ring->sq_ring
+                        : mmap(NULL, ring->cq_ring_size,
+                               PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd,
+                               IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+        ring->sqes == MAP_FAILED) {
+        if (ring->sq_ring != MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        }
+        if (!single_mmap && ring->cq_ring != MAP_FAILED) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        close(ring->fd);
+        return 0;
+    }
+    if (single_mmap) ring->cq_ring_size = 0;
+
+    char *sq = ring->sq_ring;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    char *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 1;
+}
+
+static void ring_close(Ring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring_size > 0) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// Queues one operation. The kernel only looks at the queue during
+// io_uring_enter, so the entry can be filled in after the tail moves.
+static struct io_uring_sqe *ring_queue(Ring *ring, int opcode, int fd,
+                                       void *file, int step) {
+    unsigned tail = *ring->sq_tail;
+    unsigned slot = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uint64_t)(uintptr_t)file | step;
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    return sqe;
+}
+
+// Submits the queued entries and waits for at least one completion.
+static int ring_submit_and_wait(Ring *ring) {
+    for (;;) {
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued,
+                                 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted >= 0) {
+            ring->queued -= submitted;
+            return 1;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return 0;
+    }
+}
+
+// Kept in the low bits of each entry's user_data, below the file pointer.
+enum { STEP_OPEN, STEP_STATX, STEP_READ, STEP_CLOSE };
+
+// The task comes first so the parser frees the whole struct. A close no
+// longer refers to its file, which may have been parsed and freed by then.
+typedef struct UringFile {
+    LoadTask task;
+    int fd;
+    int waiting;
+    int failed;
+    int is_regular;
+    size_t capacity;
+    double started;
+    struct statx statx;
+    struct UringFile *prev;
+    struct UringFile *next;
+} UringFile;
+
+typedef struct {
+    Ring ring;
+    FreeSlotsPool *pool;
+    FreeSlotsTaskGroup *group;
+    UringFile *reading;  // files not yet handed to the parser
+    int active;
+} UringLoader;
+
+static void queue_read(UringLoader *loader, UringFile *file) {
+    LoadedFile *loaded = &file->task.file;
+
+    struct io_uring_sqe *sqe =
+        ring_queue(&loader->ring, IORING_OP_READ, file->fd, file, STEP_READ);
+    sqe->addr = (uint64_t)(uintptr_t)(loaded->data + loaded->size);
+    sqe->len = file->capacity - loaded->size;
+    sqe->off = (uint64_t)-1;  // the file position, which pipes also have
+}
+
+static void start_file(UringLoader *loader, UringFile *file) {
+    file->fd = -1;
+    file->waiting = 2;
+    file->started = stats_now();
+    file->next = loader->reading;
+    if (loader->reading) loader->reading->prev = file;
+    loader->reading = file;
+
+    struct io_uring_sqe *sqe = ring_queue(&loader->ring, IORING_OP_OPENAT,
+                                          AT_FDCWD, file, STEP_OPEN);
+    sqe->addr = (uint64_t)(uintptr_t)file->task.path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+    sqe = ring_queue(&loader->ring, IORING_OP_STATX, AT_FDCWD, file,
+                     STEP_STATX);
+    sqe->addr = (uint64_t)(uintptr_t)file->task.path;
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = (uint64_t)(uintptr_t)&file->statx;
+    loader->active++;
+}
+
+// Hands a file to the parser and closes it. The file stays active until the
+// close completes, which bounds the operations in flight.
+static void finish_file(UringLoader *loader, UringFile *file) {
+    file->task.file.read_seconds = stats_now() - file->started;
+    if (file->prev) {
+        file->prev->next = file->next;
+    } else {
+        loader->reading = file->next;
+    }
+    if (file->next) file->next->prev = file->prev;
+
+    if (file->fd >= 0) {
+        ring_queue(&loader->ring, IORING_OP_CLOSE, file->fd, NULL, STEP_CLOSE);
+    } else {
+        loader->active--;
+    }
+
+    if (loader->pool) {
+        freeslots_pool_submit(loader->pool, loader->group, parse_loaded_file,
+                              file);
+    } else {
+        parse_loaded_file(file);
+    }
+}
+
+static void complete(UringLoader *loader, const struct io_uring_cqe *cqe) {
+    UringFile *file = (UringFile *)(uintptr_t)(cqe->user_data & ~(uint64_t)3);
+    int step = (int)(cqe->user_data & 3);
+    LoadTask *task = file ? &file->task : NULL;
+
+    switch (step) {
+    case STEP_OPEN:
+    case STEP_STATX:
+        if (step == STEP_OPEN) {
+            if (cqe->res < 0) {
+                fprintf(stderr, "Cannot open file: %s\n", task->path);
+                file->failed = 1;
+            } else {
+                file->fd = cqe->res;
+            }
+        } else {
+            file->is_regular =
+                cqe->res == 0 && S_ISREG(file->statx.stx_mode);
+            file->capacity = file->is_regular && file->statx.stx_size > 0
+                                 ? file->statx.stx_size + 1
+                                 : LOADER_DEFAULT_CAPACITY;
+        }
+
+        if (--file->waiting > 0) break;
+        if (file->failed) {
+            finish_file(loader, file);
+            break;
+        }
+        task->file.data = malloc(file->capacity);
+        queue_read(loader, file);
+        break;
+
+    case STEP_READ:
+        if (cqe->res < 0) {
+            fprintf(stderr, "Cannot read file: %s\n", task->path);
+            free(task->file.data);
+            task->file.data = NULL;
+            finish_file(loader, file);
+            break;
+        }
+
+        // Regular files only read short at the end, so there a read that
+        // does not fill the buffer is the last one. Pipes read until empty.
+        task->file.size += cqe->res;
+        if (cqe->res == 0 ||
+            (file->is_regular && task->file.size < file->capacity)) {
+            finish_file(loader, file);
+            break;
+        }
+        if (task->file.size == file->capacity) {
+            file->capacity *= 2;
+            task->file.data = realloc(task->file.data, file->capacity);
+        }
+        queue_read(loader, file);
+        break;
+
+    case STEP_CLOSE:
+        loader->active--;
+        break;
+    }
+}
+
+// Starts files while there is room in the ring. With nothing in flight it
+// waits for the next file to be known; otherwise it only takes the files
+// known already and goes back to the ring. Returns 0 once there are none.
+static int start_files(UringLoader *loader, NextFileCallback next_file,
+                       LoadedFileCallback on_file, void *user_data) {
+    while (loader->active < LOADER_FILES_IN_FLIGHT) {
+        const char *path;
+        void *context;
+        int got = next_file(user_data, loader->active == 0, &path, &context);
+        if (got < 0) return 0;
+        if (got == 0) break;
+
+        UringFile *file = calloc(1, sizeof(UringFile));
+        file->task = (LoadTask){path, {context, NULL, 0, 0}, on_file,
+                                user_data};
+        start_file(loader, file);
+    }
+    return 1;
+}
+
+// Returns 0 without taking any file if the kernel has no usable io_uring.
+// If the ring fails later on, the files it has not read yet are reported as
+// unreadable and the rest are left to the caller.
+static int load_with_io_uring(NextFileCallback next_file,
+                              LoadedFileCallback on_file, void *user_data,
+                              FreeSlotsPool *pool, FreeSlotsTaskGroup *group) {
+    UringLoader loader = {.pool = pool, .group = group};
+    if (!ring_open(&loader.ring, LOADER_RING_ENTRIES)) return 0;
+
+    int more = 1;
+    while (more || loader.active > 0) {
+        if (more) more = start_files(&loader, next_file, on_file, user_data);
+        if (loader.active == 0) continue;
+
+        if (!ring_submit_and_wait(&loader.ring)) {
+            // Reads still in flight may land in their buffers at any time,
+            // so those files are given up on and left allocated.
+            perror("io_uring_enter");
+            for (UringFile *file = loader.reading; file; file = file->next) {
+                LoadedFile loaded = file->task.file;
+                loaded.data = NULL;
+                on_file(&loaded, user_data);
+            }
+            break;
+        }
+
+        unsigned head = *loader.ring.cq_head;
+        unsigned tail = __atomic_load_n(loader.ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            complete(&loader, &loader.ring.cqes[head & *loader.ring.cq_mask]);
+        }
+        __atomic_store_n(loader.ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    ring_close(&loader.ring);
+    return 1;
+}
+
+#endif
+
+const char *load_files(NextFileCallback next_file, LoadedFileCallback on_file,
+                       void *user_data, LoaderBackend backend,
+                       FreeSlotsPool *pool) {
+    const char *used = NULL;
+    FreeSlotsTaskGroup group = {0};
+#ifdef LOADER_HAS_IO_URING
+    if (backend != LOADER_PREAD &&
+        load_with_io_uring(next_file, on_file, user_data, pool, &group)) {
+        used = "io_uring";
+    }
+#endif
+    if (!used && backend == LOADER_IO_URING) return NULL;
+    if (!used) used = "pread";
+
+    // Everything, or whatever a failed ring left over.
+    const char *path;
+    void *context;
+    while (next_file(user_data, 1, &path, &context) > 0) {
+        LoadTask *task = malloc(sizeof(LoadTask));
+        *task = (LoadTask){path, {context, NULL, 0, 0}, on_file, user_data};
+        if (pool) {
+            freeslots_pool_submit(pool, &group, pread_and_parse_task, task);
+        } else {
+            pread_and_parse_task(task);
+        }
+    }
+
+    if (pool) freeslots_pool_wait(pool, &group);
+    return used;
+}
@@ -0,0 +1,47 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stddef.h>
+
+#include "pool.h"
+
+// Reads many small input files whole. On Linux the opens, size lookups and
+// reads of a window of files are batched through one io_uring, so thousands
+// of calendars cost a few system calls each rather than a dozen; finished
+// files go to the pool to be parsed while the ring keeps reading. Kernels
+// without io_uring get pool tasks that read with pread instead.
+
+typedef enum {
+    LOADER_AUTO,
+    LOADER_IO_URING,
+    LOADER_PREAD,
+} LoaderBackend;
+
+typedef struct {
+    void *context;  // as handed out by the NextFileCallback
+    char *data;  // NULL if the file could not be read
+    size_t size;
+    double read_seconds;
+} LoadedFile;
+
+// Called once per file, on a pool worker when there is a pool. Takes
+// ownership of `data`.
+typedef void (*LoadedFileCallback)(LoadedFile *file, void *user_data);
+
+// Hands the loader its next file, on the thread that called load_files.
+// Returns 1 with `path` and `context` set, -1 when there are no more files,
+// or, when `wait` is 0, 0 if the next file is not known yet. The path must
+// stay valid until load_files returns.
+typedef int (*NextFileCallback)(void *user_data, int wait, const char **path,
+                                void **context);
+
+// Reads every file next_file hands out, starting on each as soon as it is
+// handed out, and returns once every callback has returned. Errors are
+// printed to stderr. Returns the name of the backend used, or NULL if
+// LOADER_IO_URING was asked for and the kernel does not support it, in which
+// case next_file is never called.
+const char *load_files(NextFileCallback next_file, LoadedFileCallback on_file,
+                       void *user_data, LoaderBackend backend,
+                       FreeSlotsPool *pool);
+
+#endif  // LOADER_H
@@ -0,0 +1,604 @@
+// Times the hot helpers of libfreeslots in isolation. The library source is
+// included directly so its static functions can be called; alternative
+// implementations sit next to the ones they would replace and are timed on
+// the same inputs.
+#define _GNU_SOURCE
+
+#include "freeslots.c"
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "perf.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define INPUT_COUNT 4096
+#define INPUT_MASK (INPUT_COUNT - 1)
+#define DEFAULT_ITERATIONS (1L << 22)
+#define REPEATS 7
+
+// Keeps a value, or every store before this point, from being optimized out.
+#define DO_NOT_OPTIMIZE(value) __asm__ volatile("" : : "r"(value) : "memory")
+#define CLOBBER_MEMORY() __asm__ volatile("" : : : "memory")
+
+// Defined in calender_merge.c, which nob links in with its main renamed.
+void write_time_slot(FILE *out, Date date, int start_minutes,
+                     int end_minutes);
+
+typedef struct {
+    const char *function;
+    const char *variant;
+    void (*run)(long iterations);
+} MicroBench;
+
+static char time_inputs[INPUT_COUNT][6];
+static char date_inputs[INPUT_COUNT][24];
+static char line_inputs[INPUT_COUNT][64];
+static size_t line_lengths[INPUT_COUNT];
+static Date day_inputs[INPUT_COUNT];
+static Event event_inputs[INPUT_COUNT];
+static FILE *null_output;
+
+// Days of eight sorted, partly overlapping lectures for the merge benchmark.
+#define DAY_EVENTS 8
+typedef struct {
+    int starts[DAY_EVENTS];
+    int ends[DAY_EVENTS];
+} DayEvents;
+static DayEvents day_event_inputs[INPUT_COUNT / DAY_EVENTS];
+
+// Days of disjoint busy intervals, as the union cursor hands them to the slot
+// search, at a typical density and at about the most a day can hold.
+#define GAP_DAYS 64
+#define GAP_MAX_INTERVALS 256
+typedef struct {
+    int starts[GAP_MAX_INTERVALS];
+    int ends[GAP_MAX_INTERVALS];
+    int count;
+} BusyDay;
+static BusyDay sparse_days[GAP_DAYS];
+static BusyDay dense_days[GAP_DAYS];
+
+// The dense days, one after another from 2025-01-01, as a busy index.
+static FreeSlotsBusyIndex *dense_index;
+
+static uint64_t random_state = 1;
+
+static uint64_t next_random(void) {
+    uint64_t z = (random_state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static int random_below(int bound) {
+    return (int)(next_random() % (uint64_t)bound);
+}
+
+static Date random_date(void) {
+    Date date = {2020 + random_below(10), 1 + random_below(12), 1};
+    date.day = 1 + random_below(days_in_month(date.year, date.month));
+    return date;
+}
+
+static int compare_ints(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Draws 2 * count distinct minutes and pairs them up into intervals.
+static void prepare_busy_day(BusyDay *day, int count) {
+    int minutes[2 * GAP_MAX_INTERVALS];
+    char used[24 * 60] = {0};
+    for (int i = 0; i < 2 * count; i++) {
+        int minute;
+        do minute = random_below(24 * 60);
+        while (used[minute]);
+        used[minute] = 1;
+        minutes[i] = minute;
+    }
+    qsort(minutes, 2 * count, sizeof(int), compare_ints);
+
+    day->count = count;
+    for (int i = 0; i < count; i++) {
+        day->starts[i] = minutes[2 * i];
+        day->ends[i] = minutes[2 * i + 1];
+    }
+}
+
+static void prepare_inputs(void) {
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        Date date = random_date();
+        int start = 8 * 60 + 15 * random_below(40);
+        int end = start + 45 + 15 * random_below(10);
+
+        snprintf(time_inputs[i], sizeof(time_inputs[i]), "%02d:%02d",
+                 start / 60, start % 60);
+        snprintf(date_inputs[i], sizeof(date_inputs[i]), "%04d-%02d-%02d",
+                 date.year, date.month, date.day);
+        snprintf(line_inputs[i], sizeof(line_inputs[i]),
+                 "%.10s,%02d:%02d,%.10s,%02d:%02d\n", date_inputs[i],
+                 start / 60, start % 60, date_inputs[i], end / 60, end % 60);
+        line_lengths[i] = strlen(line_inputs[i]);
+        day_inputs[i] = date;
+        event_inputs[i] = (Event){date, start, end, 0};
+    }
+
+    for (int d = 0; d < INPUT_COUNT / DAY_EVENTS; d++) {
+        DayEvents *events = &day_event_inputs[d];
+        for (int i = 0; i < DAY_EVENTS; i++) {
+            events->starts[i] = 8 * 60 + 15 * random_below(40);
+            events->ends[i] = events->starts[i] + 45 + 15 * random_below(10);
+        }
+        sort_day(events->starts, events->ends, DAY_EVENTS);
+    }
+
+    for (int d = 0; d < GAP_DAYS; d++) {
+        prepare_busy_day(&sparse_days[d], 8);
+        prepare_busy_day(&dense_days[d], GAP_MAX_INTERVALS);
+    }
+
+    FreeSlotsStore *store = freeslots_store_create();
+    int calendar = freeslots_store_add_calendar(store);
+    for (int d = 0; d < GAP_DAYS; d++) {
+        Date date = add_days_to_date((Date){2025, 1, 1}, d);
+        for (int i = 0; i < dense_days[d].count; i++) {
+            FreeSlotsEvent event = {date, dense_days[d].starts[i], date,
+                                    dense_days[d].ends[i]};
+            freeslots_store_add_event(store, calendar, &event);
+        }
+    }
+    freeslots_store_build_index(store);
+    dense_index = freeslots_busy_index_create(store, NULL, 0);
+    freeslots_store_destroy(store);
+}
+
+static void bench_parse_time(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        DO_NOT_OPTIMIZE(parse_time_to_minutes(time_inputs[i & INPUT_MASK]));
+    }
+}
+
+// Checks the fixed "HH:MM" shape directly instead of through strlen and
+// isdigit, which costs a locale table lookup per character.
+static int parse_time_fixed(const char *time_str) {
+    unsigned h1 = time_str[0] - '0', h2 = time_str[1] - '0';
+    unsigned m1 = time_str[3] - '0', m2 = time_str[4] - '0';
+    if (time_str[2] != ':' || time_str[5] != '\0' || h1 > 9 || h2 > 9 ||
+        m1 > 9 || m2 > 9) {
+        return -1;
+    }
+
+    int hours = h1 * 10 + h2;
+    int minutes = m1 * 10 + m2;
+    if (hours > 24 || minutes > 59 || (hours == 24 && minutes != 0)) {
+        return -1;
+    }
+    return hours * 60 + minutes;
+}
+
+static void bench_parse_time_fixed(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        DO_NOT_OPTIMIZE(parse_time_fixed(time_inputs[i & INPUT_MASK]));
+    }
+}
+
+static void bench_parse_date(long iterations) {
+    Date date;
+    for (long i = 0; i < iterations; i++) {
+        DO_NOT_OPTIMIZE(parse_date(date_inputs[i & INPUT_MASK], &date));
+        CLOBBER_MEMORY();
+    }
+}
+
+static void run_parse_date_field(long iterations, DateFieldKernel kernel) {
+    Date date;
+    for (long i = 0; i < iterations; i++) {
+        DO_NOT_OPTIMIZE(kernel(date_inputs[i & INPUT_MASK], &date));
+        CLOBBER_MEMORY();
+    }
+}
+
+static void bench_parse_date_scalar(long iterations) {
+    run_parse_date_field(iterations, parse_date_field_scalar);
+}
+
+static void run_parse_csv_line(long iterations, FieldEndKernel kernel) {
+    KernelSet kernels = *kernels_default();
+    kernels.field_end = kernel;
+
+    char fields[4][MAX_FIELD_LENGTH];
+    for (long i = 0; i < iterations; i++) {
+        DO_NOT_OPTIMIZE(parse_csv_line(&kernels, line_inputs[i & INPUT_MASK],
+                                       line_lengths[i & INPUT_MASK], fields,
+                                       4));
+        CLOBBER_MEMORY();
+    }
+}
+
+static void bench_parse_csv_line(long iterations) {
+    run_parse_csv_line(iterations, field_end_scalar);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static void bench_parse_date_sse42(long iterations) {
+    run_parse_date_field(iterations, parse_date_field_sse42);
+}
+
+static void bench_parse_csv_line_sse42(long iterations) {
+    run_parse_csv_line(iterations, field_end_sse42);
+}
+#endif
+
+static void bench_add_days(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        Date date = add_days_to_date(day_inputs[i & INPUT_MASK], 1);
+        DO_NOT_OPTIMIZE(date.day);
+    }
+}
+
+static void bench_add_days_month(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        Date date = add_days_to_date(day_inputs[i & INPUT_MASK], 45);
+        DO_NOT_OPTIMIZE(date.day);
+    }
+}
+
+static void bench_iso_week(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        DO_NOT_OPTIMIZE(freeslots_iso_week(day_inputs[i & INPUT_MASK], NULL));
+    }
+}
+
+static void bench_compare_events(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        DO_NOT_OPTIMIZE(compare_events(&event_inputs[i & INPUT_MASK],
+                                       &event_inputs[(i + 1) & INPUT_MASK]));
+    }
+}
+
+// Orders events by one packed integer instead of field by field.
+static uint64_t packed_event_key(const Event *event) {
+    return (uint64_t)event->date.year << 36 |
+           (uint64_t)event->date.month << 31 |
+           (uint64_t)event->date.day << 26 |
+           (uint64_t)event->start_minutes << 13 |
+           (uint64_t)event->end_minutes;
+}
+
+static int compare_events_packed(const void *a, const void *b) {
+    uint64_t key1 = packed_event_key(a);
+    uint64_t key2 = packed_event_key(b);
+    return (key1 > key2) - (key1 < key2);
+}
+
+static void bench_compare_events_packed(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        DO_NOT_OPTIMIZE(
+            compare_events_packed(&event_inputs[i & INPUT_MASK],
+                                  &event_inputs[(i + 1) & INPUT_MASK]));
+    }
+}
+
+static void bench_merge_intervals(long iterations) {
+    int starts[DAY_EVENTS], ends[DAY_EVENTS], count;
+    for (long i = 0; i < iterations; i++) {
+        const DayEvents *events =
+            &day_event_inputs[i & (INPUT_COUNT / DAY_EVENTS - 1)];
+        merge_intervals_for_day(kernels_default(), events->starts,
+                                events->ends, DAY_EVENTS, 8 * 60 + 15,
+                                17 * 60, starts, ends, &count);
+        DO_NOT_OPTIMIZE(count);
+        CLOBBER_MEMORY();
+    }
+}
+
+// Busy minutes of a dense day inside working hours, by merging the day again
+// as the slot queries do, and from the prefix sums of a busy index.
+static void bench_busy_minutes_merge(long iterations) {
+    int starts[GAP_MAX_INTERVALS], ends[GAP_MAX_INTERVALS], count;
+    for (long i = 0; i < iterations; i++) {
+        const BusyDay *day = &dense_days[i & (GAP_DAYS - 1)];
+        merge_intervals_for_day(kernels_default(), day->starts, day->ends,
+                                day->count, 8 * 60 + 15, 17 * 60, starts,
+                                ends, &count);
+        int busy = 0;
+        for (int j = 0; j < count; j++) busy += ends[j] - starts[j];
+        DO_NOT_OPTIMIZE(busy);
+    }
+}
+
+static void bench_busy_minutes_index(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        long busy = busy_in_window(dense_index, (int)(i & (GAP_DAYS - 1)),
+                                   8 * 60 + 15, 17 * 60);
+        DO_NOT_OPTIMIZE(busy);
+    }
+}
+
+// Clamps the densest days to a working-hours window, which drops about two
+// thirds of their intervals.
+static void run_clamp_filter(long iterations, ClampFilterKernel kernel) {
+    int starts[GAP_MAX_INTERVALS], ends[GAP_MAX_INTERVALS];
+    for (long i = 0; i < iterations; i++) {
+        const BusyDay *day = &dense_days[i & (GAP_DAYS - 1)];
+        DO_NOT_OPTIMIZE(kernel(day->starts, day->ends, day->count,
+                               8 * 60 + 15, 17 * 60, starts, ends));
+        CLOBBER_MEMORY();
+    }
+}
+
+static void bench_clamp_filter_scalar(long iterations) {
+    run_clamp_filter(iterations, clamp_filter_scalar);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static void bench_clamp_filter_sse2(long iterations) {
+    run_clamp_filter(iterations, clamp_filter_sse2);
+}
+
+static void bench_clamp_filter_avx2(long iterations) {
+    run_clamp_filter(iterations, clamp_filter_avx2);
+}
+
+static void bench_clamp_filter_avx512(long iterations) {
+    run_clamp_filter(iterations, clamp_filter_avx512);
+}
+#endif
+
+// Variants named after an instruction set only run on CPUs that have it.
+static int is_supported(const MicroBench *bench) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (strcmp(bench->variant, "sse4.2") == 0) {
+        return __builtin_cpu_supports("sse4.2");
+    }
+    if (strcmp(bench->variant, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(bench->variant, "avx512") == 0) {
+        return __builtin_cpu_supports("avx512f");
+    }
+#endif
+    (void)bench;
+    return 1;
+}
+
+static void count_slot(const FreeSlotsSlot *slot, void *user_data) {
+    (void)slot;
+    (*(long *)user_data)++;
+}
+
+static const Config gap_config = {8 * 60 + 15, 17 * 60, 15};
+
+static void run_gap_walk(const BusyDay *days, long iterations) {
+    long slots = 0;
+    for (long i = 0; i < iterations; i++) {
+        const BusyDay *day = &days[i & (GAP_DAYS - 1)];
+        emit_free_slots_for_day(0, (Date){2025, 9, 9}, day->starts, day->ends,
+                                day->count, gap_config, count_slot, &slots);
+    }
+    DO_NOT_OPTIMIZE(slots);
+}
+
+static void bench_gap_walk_sparse(long iterations) {
+    run_gap_walk(sparse_days, iterations);
+}
+
+static void bench_gap_walk_dense(long iterations) {
+    run_gap_walk(dense_days, iterations);
+}
+
+static void bench_print_time_slot(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        const Event *event = &event_inputs[i & INPUT_MASK];
+        write_time_slot(null_output, event->date, event->start_minutes,
+                        event->end_minutes);
+    }
+}
+
+static char *put_two_digits(char *out, int value) {
+    out[0] = '0' + value / 10;
+    out[1] = '0' + value % 10;
+    return out + 2;
+}
+
+// Formats the same line by hand and hands it to stdio in one fwrite.
+static void write_time_slot_fixed(FILE *out, Date date, int start_minutes,
+                                  int end_minutes) {
+    char line[64];
+    char *p = line;
+
+    p = put_two_digits(p, date.year / 100);
+    p = put_two_digits(p, date.year % 100);
+    *p++ = '-';
+    p = put_two_digits(p, date.month);
+    *p++ = '-';
+    p = put_two_digits(p, date.day);
+    memcpy(p, "   ", 3), p += 3;
+    p = put_two_digits(p, start_minutes / 60);
+    *p++ = ':';
+    p = put_two_digits(p, start_minutes % 60);
+    memcpy(p, "   ", 3), p += 3;
+    p = put_two_digits(p, end_minutes / 60);
+    *p++ = ':';
+    p = put_two_digits(p, end_minutes % 60);
+    memcpy(p, "   ", 3), p += 3;
+
+    char digits[12];
+    int length = 0;
+    unsigned duration = end_minutes - start_minutes;
+    do {
+        digits[length++] = '0' + duration % 10;
+        duration /= 10;
+    } while (duration);
+    while (length) *p++ = digits[--length];
+    *p++ = '\n';
+
+    fwrite(line, 1, p - line, out);
+}
+
+static void bench_print_time_slot_fixed(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        const Event *event = &event_inputs[i & INPUT_MASK];
+        write_time_slot_fixed(null_output, event->date, event->start_minutes,
+                              event->end_minutes);
+    }
+}
+
+static MicroBench benches[] = {
+    {"parse_time_to_minutes", "baseline", bench_parse_time},
+    {"parse_time_to_minutes", "fixed", bench_parse_time_fixed},
+    {"parse_date", "baseline", bench_parse_date},
+    {"parse_date", "scalar", bench_parse_date_scalar},
+#if defined(__x86_64__) || defined(__i386__)
+    {"parse_date", "sse4.2", bench_parse_date_sse42},
+#endif
+    {"parse_csv_line", "scalar", bench_parse_csv_line},
+#if defined(__x86_64__) || defined(__i386__)
+    {"parse_csv_line", "sse4.2", bench_parse_csv_line_sse42},
+#endif
+    {"add_days_to_date", "+1", bench_add_days},
+    {"add_days_to_date", "+45", bench_add_days_month},
+    {"freeslots_iso_week", "baseline", bench_iso_week},
+    {"compare_events", "baseline", bench_compare_events},
+    {"compare_events", "packed", bench_compare_events_packed},
+    {"merge_intervals_for_day", "8 events", bench_merge_intervals},
+    {"clamp_filter", "scalar", bench_clamp_filter_scalar},
+#if defined(__x86_64__) || defined(__i386__)
+    {"clamp_filter", "sse2", bench_clamp_filter_sse2},
+    {"clamp_filter", "avx2", bench_clamp_filter_avx2},
+    {"clamp_filter", "avx512", bench_clamp_filter_avx512},
+#endif
+    {"busy_in_window", "merge 256", bench_busy_minutes_merge},
+    {"busy_in_window", "prefix 256", bench_busy_minutes_index},
+    {"emit_free_slots", "walk 8", bench_gap_walk_sparse},
+    {"emit_free_slots", "walk 256", bench_gap_walk_dense},
+    {"print_time_slot", "baseline", bench_print_time_slot},
+    {"print_time_slot", "fixed", bench_print_time_slot_fixed},
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reads the cycle counter from perf when the CPU exposes one, and otherwise
+// the time stamp counter, which ticks at a fixed reference rate.
+static double read_cycles(PerfCounters *perf) {
+    PerfSample sample;
+    if (perf && perf_counters_available(perf, PERF_CYCLES) &&
+        perf_counters_read(perf, &sample)) {
+        return sample.values[PERF_CYCLES];
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return (double)__rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Runs one benchmark REPEATS times after a warmup and keeps the fastest
+// repeat, which is the one least disturbed by the rest of the system.
+static void run_bench(const MicroBench *bench, long iterations,
+                      PerfCounters *perf) {
+    bench->run(iterations / 8);
+
+    double best_seconds = 0, best_cycles = 0;
+    for (int r = 0; r < REPEATS; r++) {
+        double cycles = read_cycles(perf);
+        double start = now_seconds();
+        bench->run(iterations);
+        double seconds = now_seconds() - start;
+        cycles = read_cycles(perf) - cycles;
+
+        if (r == 0 || seconds < best_seconds) {
+            best_seconds = seconds;
+            best_cycles = cycles;
+        }
+    }
+
+    printf("%-24s %-12s %10.2f %10.2f\n", bench->function, bench->variant,
+           best_seconds * 1e9 / iterations, best_cycles / iterations);
+    fflush(stdout);
+}
+
+static void print_usage(const char *program_name) {
+    fprintf(stderr,
+            "Usage: %s [options] [FUNCTION...]\n\n"
+            "Times libfreeslots helpers; FUNCTION selects benchmarks by "
+            "name.\n\n"
+            "Options:\n"
+            "  --iterations N   Calls per repeat (default: %ld)\n"
+            "  --cpu N          Pin to CPU N (default: 0)\n",
+            program_name, DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = DEFAULT_ITERATIONS;
+    int cpu = 0;
+
+    int arg_index = 1;
+    while (arg_index < argc && argv[arg_index][0] == '-') {
+        if (arg_index + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[arg_index], "--iterations") == 0) {
+            iterations = atol(argv[arg_index + 1]);
+        } else if (strcmp(argv[arg_index], "--cpu") == 0) {
+            cpu = atoi(argv[arg_index + 1]);
+        } else {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[arg_index]);
+            print_usage(argv[0]);
+            return 1;
+        }
+        arg_index += 2;
+    }
+    if (iterations < 8) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "Warning: could not pin to CPU %d\n", cpu);
+    }
+#endif
+
+    null_output = fopen("/dev/null", "w");
+    if (!null_output) {
+        fprintf(stderr, "Cannot open /dev/null\n");
+        return 1;
+    }
+    prepare_inputs();
+
+    PerfCounters *perf = perf_counters_open();
+    int perf_cycles = perf && perf_counters_available(perf, PERF_CYCLES);
+    printf("%ld iterations, best of %d; cycles from %s\n", iterations, REPEATS,
+           perf_cycles ? "perf" : "the time stamp counter");
+    printf("%-24s %-12s %10s %10s\n", "function", "variant", "ns/op",
+           "cycles/op");
+
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        int selected = arg_index == argc;
+        for (int a = arg_index; a < argc; a++) {
+            if (strcmp(argv[a], benches[i].function) == 0) selected = 1;
+        }
+        if (selected && is_supported(&benches[i])) {
+            run_bench(&benches[i], iterations, perf);
+        }
+    }
+
+    perf_counters_close(perf);
+    fclose(null_output);
+    return 0;
+}
@@ -1,16 +1,1138 @@
 #define NOB_IMPLEMENTATION
 #include "include/nob.h"
 
+#include <math.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define BUILD_DIR "build"
+#define BENCH_DIR BUILD_DIR "/bench"
+#define BENCH_MAX_RUNS 16
+#define BENCH_HISTORY BENCH_DIR "/history.jsonl"
+#define MAIN_CFLAGS "-std=c99", "-O2", "-Wall", "-Wextra"
+#define RELEASE_DIR BUILD_DIR "/release"
+#define PGO_DIR BUILD_DIR "/pgo"
+#define MATRIX_DIR BUILD_DIR "/matrix"
+#define MICROBENCH_DIR BUILD_DIR "/microbench"
+#define TESTS_DIR "tests"
+#define TEST_BUILD_DIR BUILD_DIR "/tests"
+
+typedef struct {
+    const char *name;
+    long target_events;
+    int calendars;
+    int years;
+    int events_per_day;
+    int runs;
+} BenchScenario;
+
+typedef struct {
+    long rows;
+    int runs;
+    double seconds[BENCH_MAX_RUNS];
+    double median;
+    double p95;
+    long max_rss_kb;
+} BenchResult;
+
+// What a history record says about where its numbers came from.
+typedef struct {
+    char run[32];
+    char revision[64];
+    char machine[512];
+} BenchContext;
+
+// One scenario of one binary as read back from BENCH_HISTORY.
+typedef struct {
+    char run[32];
+    char revision[64];
+    char machine[512];
+    char binary[256];
+    char scenario[16];
+    double samples[BENCH_MAX_RUNS];
+    int runs;
+    double median;
+} HistoryEntry;
+
+// Each corpus is generated once into BENCH_DIR/<name> and reused. Weekdays
+// only, so one calendar-year is about 261 days times events_per_day rows.
+BenchScenario bench_scenarios[] = {
+    {"1K", 1000L, 1, 1, 4, 9},
+    {"10K", 10000L, 10, 1, 4, 9},
+    {"100K", 100000L, 100, 1, 4, 7},
+    {"1M", 1000000L, 250, 1, 16, 5},
+    {"10M", 10000000L, 1000, 2, 20, 5},
+    {"100M", 100000000L, 4000, 4, 24, 5},
+};
+
+// Reads the first line a shell command prints, without the newline.
+void read_command_line(const char *command, char *buffer, size_t size) {
+    buffer[0] = '\0';
+    FILE *pipe = popen(command, "r");
+    if (!pipe) return;
+    if (fgets(buffer, size, pipe)) buffer[strcspn(buffer, "\n")] = '\0';
+    pclose(pipe);
+}
+
+// The compiler and flags a binary was built with are kept next to it, in
+// BINARY.build, for bench to record with its timings. ./freeslots keeps its
+// own in BUILD_DIR.
+const char *build_info_path(const char *binary) {
+    if (strcmp(binary, "freeslots") == 0 ||
+        strcmp(binary, "./freeslots") == 0) {
+        return BUILD_DIR "/freeslots.build";
+    }
+    return nob_temp_sprintf("%s.build", binary);
+}
+
+bool write_build_info(const char *binary, const char *compiler,
+                      const Nob_Cmd *flags) {
+    char version[128];
+    read_command_line(nob_temp_sprintf("%s --version 2>/dev/null", compiler),
+                      version, sizeof(version));
+
+    Nob_String_Builder sb = {0};
+    nob_sb_append_cstr(&sb, version);
+    nob_sb_append_cstr(&sb, "\n");
+    for (size_t i = 0; i < flags->count; i++) {
+        if (i > 0) nob_sb_append_cstr(&sb, " ");
+        nob_sb_append_cstr(&sb, flags->items[i]);
+    }
+    nob_sb_append_cstr(&sb, "\n");
+
+    bool ok = nob_write_entire_file(build_info_path(binary), sb.items,
+                                    sb.count);
+    nob_sb_free(sb);
+    return ok;
+}
+
+// Reads what write_build_info recorded, or leaves both empty for a binary
+// built some other way.
+void read_build_info(const char *binary, char *compiler, size_t compiler_size,
+                     char *flags, size_t flags_size) {
+    compiler[0] = '\0';
+    flags[0] = '\0';
+    FILE *file = fopen(build_info_path(binary), "r");
+    if (!file) return;
+    if (fgets(compiler, compiler_size, file)) {
+        compiler[strcspn(compiler, "\n")] = '\0';
+    }
+    if (fgets(flags, flags_size, file)) flags[strcspn(flags, "\n")] = '\0';
+    fclose(file);
+}
+
+bool build_library() {
+    Nob_Cmd cmd = {0};
+
+    if (!nob_mkdir_if_not_exists(BUILD_DIR)) return false;
+
+    nob_cmd_append(&cmd, "cc", "-std=c99", "-O2", "-Wall", "-Wextra", "-fPIC",
+                   "-c", "-o", BUILD_DIR "/freeslots.o", "freeslots.c");
+    if (!nob_cmd_run(&cmd)) return false;
+
+    nob_cmd_append(&cmd, "cc", "-std=c99", "-O2", "-Wall", "-Wextra", "-fPIC",
+                   "-pthread", "-c", "-o", BUILD_DIR "/pool.o", "pool.c");
+    if (!nob_cmd_run(&cmd)) return false;
+
+    nob_cmd_append(&cmd, "cc", "-std=c99", "-O2", "-Wall", "-Wextra", "-fPIC",
+                   "-pthread", "-c", "-o", BUILD_DIR "/kernels.o",
+                   "kernels.c");
+    if (!nob_cmd_run(&cmd)) return false;
+
+    nob_cmd_append(&cmd, "ar", "rcs", BUILD_DIR "/libfreeslots.a",
+                   BUILD_DIR "/freeslots.o", BUILD_DIR "/pool.o",
+                   BUILD_DIR "/kernels.o");
+    if (!nob_cmd_run(&cmd)) return false;
+
+    nob_cmd_append(&cmd, "cc", "-shared", "-pthread", "-o",
+                   BUILD_DIR "/libfreeslots.so", BUILD_DIR "/freeslots.o",
+                   BUILD_DIR "/pool.o", BUILD_DIR "/kernels.o");
+    if (!nob_cmd_run(&cmd)) return false;
+
+    return true;
+}
+
 bool build_main_executable() {
     Nob_Cmd cmd = {0};
 
+    if (!build_library()) return false;
+
+    nob_cmd_append(&cmd, "cc", MAIN_CFLAGS, "-pthread", "-o", "freeslots",
+                   "calender_merge.c", "cache.c", "discovery.c",
+                   "loader.c", "pipeline.c", "report.c", "stats.c",
+                   "perf.c", "trace.c", BUILD_DIR "/libfreeslots.a");
+    if (!nob_cmd_run(&cmd)) return false;
+
+    Nob_Cmd flags = {0};
+    nob_cmd_append(&flags, MAIN_CFLAGS, "-pthread");
+    bool ok = write_build_info("freeslots", "cc", &flags);
+    nob_cmd_free(flags);
+    return ok;
+}
+
+// Every translation unit of the freeslots executable, library included, so a
+// variant can be compiled and linked as a whole with -flto.
+const char *freeslots_sources[] = {
+    "calender_merge.c", "cache.c", "discovery.c", "loader.c", "pipeline.c",
+    "report.c",         "stats.c", "perf.c",      "trace.c",     "freeslots.c",
+    "pool.c",           "kernels.c",
+};
+
+const char *variant_object(const char *object_dir, const char *source) {
+    return nob_temp_sprintf("%s/%.*s.o", object_dir,
+                            (int)(strlen(source) - 2), source);
+}
+
+// Runs CMD to completion, or queues it on PROCS when that is not NULL.
+bool run_variant_step(Nob_Cmd *cmd, Nob_Procs *procs) {
+    if (procs) {
+        return nob_cmd_run(cmd, .async = procs, .max_procs = nob_nprocs());
+    }
+    return nob_cmd_run(cmd);
+}
+
+// Compiles each source into OBJECT_DIR. Object names are stable, which is
+// what lets a -fprofile-use build find the .gcda files its instrumented twin
+// left next to them.
+bool compile_variant(const char *compiler, const char *object_dir,
+                     const Nob_Cmd *flags, Nob_Procs *procs) {
+    Nob_Cmd cmd = {0};
+    bool result = true;
+
+    if (!nob_mkdir_if_not_exists(object_dir)) nob_return_defer(false);
+
+    for (size_t i = 0; i < NOB_ARRAY_LEN(freeslots_sources); i++) {
+        const char *source = freeslots_sources[i];
+
+        nob_cmd_append(&cmd, compiler, "-std=c99", "-Wall", "-Wextra",
+                       "-pthread");
+        nob_cmd_extend(&cmd, flags);
+        nob_cmd_append(&cmd, "-c", "-o", variant_object(object_dir, source),
+                       source);
+        if (!run_variant_step(&cmd, procs)) nob_return_defer(false);
+    }
+
+defer:
+    nob_cmd_free(cmd);
+    return result;
+}
+
+// Links the objects of OBJECT_DIR with the same FLAGS they were compiled
+// with, so -flto sees the whole program.
+bool link_variant(const char *compiler, const char *object_dir,
+                  const char *output, const Nob_Cmd *flags,
+                  Nob_Procs *procs) {
+    Nob_Cmd cmd = {0};
+
+    nob_cmd_append(&cmd, compiler, "-pthread");
+    nob_cmd_extend(&cmd, flags);
+    nob_cmd_append(&cmd, "-o", output);
+    for (size_t i = 0; i < NOB_ARRAY_LEN(freeslots_sources); i++) {
+        nob_cmd_append(&cmd, variant_object(object_dir, freeslots_sources[i]));
+    }
+
+    // Recorded as compile_variant passes them.
+    Nob_Cmd build_flags = {0};
+    nob_cmd_append(&build_flags, "-std=c99", "-Wall", "-Wextra", "-pthread");
+    nob_cmd_extend(&build_flags, flags);
+
+    bool ok = run_variant_step(&cmd, procs) &&
+              write_build_info(output, compiler, &build_flags);
+    nob_cmd_free(build_flags);
+    nob_cmd_free(cmd);
+    return ok;
+}
+
+bool build_variant(const char *compiler, const char *object_dir,
+                   const char *output, const Nob_Cmd *flags) {
+    return compile_variant(compiler, object_dir, flags, NULL) &&
+           link_variant(compiler, object_dir, output, flags, NULL);
+}
+
+bool build_release(const char *march) {
+    Nob_Cmd flags = {0};
+    nob_cmd_append(&flags, "-O3", "-flto",
+                   nob_temp_sprintf("-march=%s", march));
+
+    bool ok = nob_mkdir_if_not_exists(RELEASE_DIR) &&
+              build_variant("cc", RELEASE_DIR "/obj",
+                            RELEASE_DIR "/freeslots", &flags);
+    nob_cmd_free(flags);
+    if (ok) nob_log(NOB_INFO, "Built " RELEASE_DIR "/freeslots");
+    return ok;
+}
+
+bool build_generator() {
+    Nob_Cmd cmd = {0};
+
+    if (!nob_mkdir_if_not_exists(BUILD_DIR)) return false;
+
     nob_cmd_append(&cmd, "cc", "-std=c99", "-O2", "-Wall", "-Wextra", "-o",
-                   "freeslots", "calender_merge.c");
-    if (!nob_cmd_run(&cmd)) return 1;
+                   BUILD_DIR "/gen_calendars", "gen_calendars.c");
+    if (!nob_cmd_run(&cmd)) return false;
+
+    return true;
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+long parse_event_count(const char *str) {
+    char *end;
+    long value = strtol(str, &end, 10);
+    if (*end == 'K' || *end == 'k') value *= 1000L, end++;
+    else if (*end == 'M' || *end == 'm') value *= 1000000L, end++;
+    return (*end == '\0' && value > 0) ? value : -1;
+}
+
+// Returns the number of rows in the corpus, generating it on first use.
+long prepare_corpus(const BenchScenario *scenario) {
+    const char *dir = nob_temp_sprintf("%s/%s", BENCH_DIR, scenario->name);
+    const char *rows_path = nob_temp_sprintf("%s/rows", dir);
+
+    Nob_String_Builder sb = {0};
+    if (nob_file_exists(rows_path) == 1 &&
+        nob_read_entire_file(rows_path, &sb)) {
+        nob_sb_append_null(&sb);
+        long rows = atol(sb.items);
+        nob_sb_free(sb);
+        return rows;
+    }
+
+    nob_log(NOB_INFO, "Generating %s corpus in %s", scenario->name, dir);
+    const char *command = nob_temp_sprintf(
+        BUILD_DIR "/gen_calendars --calendars %d --years %d "
+                  "--events-per-day %d --seed 1 %s",
+        scenario->calendars, scenario->years, scenario->events_per_day, dir);
+
+    FILE *generator = popen(command, "r");
+    if (!generator) return -1;
+    long rows = -1;
+    if (fscanf(generator, "%ld", &rows) != 1) rows = -1;
+    if (pclose(generator) != 0 || rows < 0) {
+        nob_log(NOB_ERROR, "Could not generate %s corpus", scenario->name);
+        return -1;
+    }
+
+    const char *text = nob_temp_sprintf("%ld\n", rows);
+    if (!nob_write_entire_file(rows_path, text, strlen(text))) return -1;
+    return rows;
+}
+
+// Runs argv with stdout and stderr discarded. Reports wall time and the
+// child's peak resident set in KiB.
+bool run_timed(char *const *argv, double *seconds, long *max_rss_kb) {
+    double start = now_seconds();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        nob_log(NOB_ERROR, "Could not fork: %s", strerror(errno));
+        return false;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        nob_log(NOB_ERROR, "Could not wait on %s: %s", argv[0],
+                strerror(errno));
+        return false;
+    }
+    *seconds = now_seconds() - start;
+    *max_rss_kb = usage.ru_maxrss;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        nob_log(NOB_ERROR, "%s exited abnormally", argv[0]);
+        return false;
+    }
+    return true;
+}
+
+// Times repeated runs of BINARY on one corpus. The samples are left sorted.
+bool measure_scenario(const BenchScenario *scenario, const char *binary,
+                      BenchResult *result) {
+    long rows = prepare_corpus(scenario);
+    if (rows < 0) return false;
+
+    Nob_Cmd cmd = {0};
+    nob_cmd_append(&cmd, binary, "-w", "08:00-18:00", "-m", "30");
+    for (int i = 0; i < scenario->calendars; i++) {
+        nob_cmd_append(&cmd, nob_temp_sprintf("%s/%s/cal%05d.csv", BENCH_DIR,
+                                              scenario->name, i));
+    }
+    nob_cmd_append(&cmd, NULL);
+
+    // One untimed run first so every timed run sees a warm page cache.
+    double *seconds = result->seconds;
+    long max_rss_kb = 0;
+    for (int i = -1; i < scenario->runs; i++) {
+        double elapsed;
+        long rss_kb;
+        if (!run_timed((char *const *)cmd.items, &elapsed, &rss_kb)) {
+            nob_cmd_free(cmd);
+            return false;
+        }
+        if (i < 0) continue;
+        seconds[i] = elapsed;
+        if (rss_kb > max_rss_kb) max_rss_kb = rss_kb;
+    }
+    nob_cmd_free(cmd);
+
+    int runs = scenario->runs;
+    qsort(seconds, runs, sizeof(double), compare_doubles);
+    double median = runs % 2 ? seconds[runs / 2]
+                             : (seconds[runs / 2 - 1] + seconds[runs / 2]) / 2;
+    int p95_rank = (95 * runs + 99) / 100;
+
+    result->rows = rows;
+    result->runs = runs;
+    result->median = median;
+    result->p95 = seconds[p95_rank - 1];
+    result->max_rss_kb = max_rss_kb;
+    return true;
+}
+
+void init_bench_context(BenchContext *context) {
+    snprintf(context->run, sizeof(context->run), "%ld", (long)time(NULL));
+    read_command_line("git describe --always --dirty 2>/dev/null",
+                      context->revision, sizeof(context->revision));
+
+    char cpu[128] = "";
+    read_command_line("sed -n 's/^model name[^:]*: //p' /proc/cpuinfo "
+                      "2>/dev/null",
+                      cpu, sizeof(cpu));
+    struct utsname name;
+    if (uname(&name) != 0) memset(&name, 0, sizeof(name));
+    snprintf(context->machine, sizeof(context->machine),
+             "%s %s %s, %d CPUs%s%s", name.sysname, name.release,
+             name.machine, nob_nprocs(), cpu[0] ? ", " : "", cpu);
+}
+
+void write_json_string(FILE *file, const char *str) {
+    fputc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') fputc('\\', file);
+        if ((unsigned char)*str >= 0x20) fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+void append_history(FILE *history, const BenchContext *context,
+                    const char *binary, const BenchScenario *scenario,
+                    const BenchResult *result) {
+    char compiler[128];
+    char flags[512];
+    read_build_info(binary, compiler, sizeof(compiler), flags, sizeof(flags));
+
+    const char *fields[][2] = {
+        {"run", context->run},
+        {"revision", context->revision},
+        {"compiler", compiler},
+        {"flags", flags},
+        {"machine", context->machine},
+        {"binary", binary},
+        {"scenario", scenario->name},
+    };
+
+    fputc('{', history);
+    for (size_t i = 0; i < NOB_ARRAY_LEN(fields); i++) {
+        fprintf(history, "\"%s\":", fields[i][0]);
+        write_json_string(history, fields[i][1]);
+        fputc(',', history);
+    }
+    fprintf(history,
+            "\"rows\":%ld,\"runs\":%d,\"median_ms\":%.4f,\"p95_ms\":%.4f,"
+            "\"events_per_s\":%.0f,\"peak_rss_kb\":%ld,\"samples_ms\":[",
+            result->rows, result->runs, result->median * 1e3,
+            result->p95 * 1e3, result->rows / result->median,
+            result->max_rss_kb);
+    for (int i = 0; i < result->runs; i++) {
+        fprintf(history, "%s%.4f", i ? "," : "", result->seconds[i] * 1e3);
+    }
+    fprintf(history, "]}\n");
+}
+
+bool run_bench_scenario(const BenchScenario *scenario, const char *binary,
+                        const BenchContext *context, FILE *history) {
+    BenchResult result;
+    if (!measure_scenario(scenario, binary, &result)) return false;
+
+    printf("%-24s %-6s %12ld %5d %12.2f %12.2f %14.0f %10.1f\n", binary,
+           scenario->name, result.rows, result.runs, result.median * 1e3,
+           result.p95 * 1e3, result.rows / result.median,
+           result.max_rss_kb / 1024.0);
+    fflush(stdout);
+
+    append_history(history, context, binary, scenario, &result);
+    fflush(history);
+    return true;
+}
+
+// Times each binary on every corpus up to MAX_EVENTS and appends the results
+// to BENCH_HISTORY, tagged with CONTEXT. Without binaries it builds and times
+// ./freeslots.
+bool bench(long max_events, const char **binaries, size_t binary_count,
+           const BenchContext *context) {
+    const char *default_binary = "./freeslots";
+    if (binary_count == 0) {
+        if (!build_main_executable()) return false;
+        binaries = &default_binary;
+        binary_count = 1;
+    }
+    if (!build_generator()) return false;
+    if (!nob_mkdir_if_not_exists(BENCH_DIR)) return false;
+
+    FILE *history = fopen(BENCH_HISTORY, "a");
+    if (!history) {
+        nob_log(NOB_ERROR, "Could not open %s: %s", BENCH_HISTORY,
+                strerror(errno));
+        return false;
+    }
+
+    printf("%-24s %-6s %12s %5s %12s %12s %14s %10s\n", "binary", "corpus",
+           "events", "runs", "median ms", "p95 ms", "events/s", "peak MiB");
+
+    for (size_t i = 0; i < NOB_ARRAY_LEN(bench_scenarios); i++) {
+        if (bench_scenarios[i].target_events > max_events) break;
+
+        for (size_t b = 0; b < binary_count; b++) {
+            size_t mark = nob_temp_save();
+            bool ok = run_bench_scenario(&bench_scenarios[i], binaries[b],
+                                         context, history);
+            nob_temp_rewind(mark);
+            if (!ok) {
+                fclose(history);
+                return false;
+            }
+        }
+    }
+
+    fclose(history);
+    return true;
+}
+
+// Copies the string value of "key" from one history line. The history is
+// only ever written by append_history, so a flat scan is enough.
+bool json_string_field(const char *line, const char *key, char *value,
+                       size_t size) {
+    const char *found = strstr(line, nob_temp_sprintf("\"%s\":\"", key));
+    if (!found) return false;
+    found += strlen(key) + 4;
+
+    size_t length = 0;
+    while (*found && *found != '"' && length + 1 < size) {
+        if (*found == '\\' && found[1]) found++;
+        value[length++] = *found++;
+    }
+    value[length] = '\0';
+    return true;
+}
+
+bool parse_history_entry(const char *line, HistoryEntry *entry) {
+    memset(entry, 0, sizeof(HistoryEntry));
+    if (!json_string_field(line, "run", entry->run, sizeof(entry->run)) ||
+        !json_string_field(line, "revision", entry->revision,
+                           sizeof(entry->revision)) ||
+        !json_string_field(line, "machine", entry->machine,
+                           sizeof(entry->machine)) ||
+        !json_string_field(line, "binary", entry->binary,
+                           sizeof(entry->binary)) ||
+        !json_string_field(line, "scenario", entry->scenario,
+                           sizeof(entry->scenario))) {
+        return false;
+    }
+
+    const char *median = strstr(line, "\"median_ms\":");
+    const char *samples = strstr(line, "\"samples_ms\":[");
+    if (!median || !samples) return false;
+    entry->median = strtod(median + 12, NULL) / 1e3;
+
+    const char *cursor = samples + 14;
+    while (*cursor != ']' && entry->runs < BENCH_MAX_RUNS) {
+        char *end;
+        double value = strtod(cursor, &end);
+        if (end == cursor) return false;
+        entry->samples[entry->runs++] = value / 1e3;
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    return entry->runs > 0;
+}
+
+// Loads the scenarios of the newest ./freeslots run whose revision starts
+// with REVISION (any revision when NULL).
+size_t load_baseline(const char *revision, HistoryEntry *entries,
+                     size_t capacity) {
+    Nob_String_Builder sb = {0};
+    if (nob_file_exists(BENCH_HISTORY) != 1 ||
+        !nob_read_entire_file(BENCH_HISTORY, &sb)) {
+        return 0;
+    }
+    nob_sb_append_null(&sb);
+
+    char run[32] = "";
+    size_t count = 0;
+    HistoryEntry entry;
+
+    for (char *line = strtok(sb.items, "\n"); line;
+         line = strtok(NULL, "\n")) {
+        if (!parse_history_entry(line, &entry)) continue;
+        if (strcmp(entry.binary, "./freeslots") != 0) continue;
+        if (revision && strncmp(entry.revision, revision, strlen(revision))) {
+            continue;
+        }
+
+        if (strcmp(entry.run, run) != 0) {
+            memcpy(run, entry.run, sizeof(run));
+            count = 0;
+        }
+        if (count < capacity) entries[count++] = entry;
+    }
+
+    nob_sb_free(sb);
+    return count;
+}
+
+// Exact two-sided Mann-Whitney U test for small samples. The number of
+// orderings giving each U is counted by the recurrence
+// f(m, n, u) = f(m - 1, n, u - n) + f(m, n - 1, u).
+double mann_whitney_p(const double *a, int m, const double *b, int n) {
+    double u = 0;
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            u += a[i] > b[j] ? 1 : a[i] == b[j] ? 0.5 : 0;
+        }
+    }
+
+    int max_u = m * n;
+    double *counts = calloc((size_t)(m + 1) * (n + 1) * (max_u + 1),
+                            sizeof(double));
+    if (!counts) return 1;
+#define COUNT(i, j, k) counts[((size_t)(i) * (n + 1) + (j)) * (max_u + 1) + (k)]
+    for (int i = 0; i <= m; i++) {
+        for (int j = 0; j <= n; j++) {
+            for (int k = 0; k <= max_u; k++) {
+                if (i == 0 || j == 0) {
+                    COUNT(i, j, k) = k == 0;
+                } else {
+                    COUNT(i, j, k) = (k >= j ? COUNT(i - 1, j, k - j) : 0) +
+                                     COUNT(i, j - 1, k);
+                }
+            }
+        }
+    }
+
+    double total = 0, tail = 0;
+    double extreme = fabs(u - max_u / 2.0);
+    for (int k = 0; k <= max_u; k++) {
+        total += COUNT(m, n, k);
+        if (fabs(k - max_u / 2.0) >= extreme - 1e-9) tail += COUNT(m, n, k);
+    }
+#undef COUNT
+
+    free(counts);
+    return tail / total;
+}
+
+// The smallest two-sided p the exact test can give for m and n samples, when
+// every sample of one side beats every sample of the other: 2 / C(m + n, m).
+double mann_whitney_min_p(int m, int n) {
+    double ways = 1;
+    for (int i = 1; i <= m; i++) ways = ways * (n + i) / i;
+    return 2 / ways;
+}
+
+// Runs the benchmark for the current tree and compares each scenario with
+// the stored baseline. A scenario regresses when its median is more than
+// THRESHOLD slower and the samples differ at p < 0.05, so a single noisy run
+// does not fail the gate. With too few samples for the test to ever reach
+// 0.05, as in history recorded with three runs, the median alone decides and
+// the p column says so.
+bool bench_compare(const char *revision, long max_events, double threshold) {
+    HistoryEntry baseline[NOB_ARRAY_LEN(bench_scenarios)];
+    size_t baseline_count =
+        load_baseline(revision, baseline, NOB_ARRAY_LEN(baseline));
+    if (baseline_count == 0) {
+        nob_log(NOB_ERROR, "No baseline in %s%s%s; run ./nob bench first",
+                BENCH_HISTORY, revision ? " for revision " : "",
+                revision ? revision : "");
+        return false;
+    }
+
+    BenchContext context;
+    init_bench_context(&context);
+    if (!bench(max_events, NULL, 0, &context)) return false;
+
+    HistoryEntry current[NOB_ARRAY_LEN(bench_scenarios)];
+    size_t current_count =
+        load_baseline(context.revision, current, NOB_ARRAY_LEN(current));
+
+    if (strcmp(baseline[0].machine, context.machine) != 0) {
+        nob_log(NOB_WARNING, "Baseline was recorded on: %s",
+                baseline[0].machine);
+    }
+
+    printf("\nBaseline %s (run %s) vs %s:\n", baseline[0].revision,
+           baseline[0].run, context.revision);
+    printf("%-6s %12s %12s %9s %8s  %s\n", "corpus", "base ms", "now ms",
+           "change", "p", "verdict");
+
+    int regressions = 0;
+    for (size_t i = 0; i < current_count; i++) {
+        const HistoryEntry *now = &current[i];
+        const HistoryEntry *base = NULL;
+        for (size_t j = 0; j < baseline_count; j++) {
+            if (strcmp(baseline[j].scenario, now->scenario) == 0) {
+                base = &baseline[j];
+            }
+        }
+        if (!base) continue;
+
+        double change = now->median / base->median - 1;
+        double p = mann_whitney_p(now->samples, now->runs, base->samples,
+                                  base->runs);
+        int testable = mann_whitney_min_p(now->runs, base->runs) < 0.05;
+        int differs = !testable || p < 0.05;
+        const char *verdict = "same";
+        if (differs && change > threshold) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (differs && change < -threshold) {
+            verdict = "faster";
+        }
 
+        if (testable) {
+            printf("%-6s %12.2f %12.2f %+8.1f%% %8.3f  %s\n", now->scenario,
+                   base->median * 1e3, now->median * 1e3, change * 100, p,
+                   verdict);
+        } else {
+            printf("%-6s %12.2f %12.2f %+8.1f%% %8s  %s (median only, "
+                   "%d vs %d runs)\n",
+                   now->scenario, base->median * 1e3, now->median * 1e3,
+                   change * 100, "n/a", verdict, now->runs, base->runs);
+        }
+    }
+
+    if (regressions > 0) {
+        nob_log(NOB_ERROR, "%d scenario(s) regressed by more than %.0f%%",
+                regressions, threshold * 100);
+        return false;
+    }
     return true;
 }
 
+// Instruments a build, trains it on the 1M benchmark corpus and rebuilds
+// with the recorded profile. Both builds share PGO_DIR/obj, so the profile
+// lands where the final compile looks for it. The steps are gcc's: clang
+// writes .profraw files that need an llvm-profdata merge, so gcc is named
+// rather than whatever cc is.
+bool build_pgo(const char *march) {
+    const char *compiler = "gcc";
+    const char *object_dir = PGO_DIR "/obj";
+    const char *instrumented = PGO_DIR "/freeslots-instrumented";
+    bool result = true;
+    Nob_Cmd flags = {0};
+    Nob_Cmd cmd = {0};
+
+    nob_cmd_append(&flags, "-O3", nob_temp_sprintf("-march=%s", march),
+                   "-fprofile-generate", "-fprofile-update=atomic");
+    if (!nob_mkdir_if_not_exists(PGO_DIR)) nob_return_defer(false);
+    if (!build_variant(compiler, object_dir, instrumented, &flags)) {
+        nob_return_defer(false);
+    }
+
+    // Counters accumulate across runs, so start from an empty profile.
+    for (size_t i = 0; i < NOB_ARRAY_LEN(freeslots_sources); i++) {
+        const char *source = freeslots_sources[i];
+        const char *profile = nob_temp_sprintf(
+            "%s/%.*s.gcda", object_dir, (int)(strlen(source) - 2), source);
+        if (nob_file_exists(profile) == 1 && !nob_delete_file(profile)) {
+            nob_return_defer(false);
+        }
+    }
+
+    if (!build_generator()) nob_return_defer(false);
+    if (!nob_mkdir_if_not_exists(BENCH_DIR)) nob_return_defer(false);
+    const BenchScenario *training = &bench_scenarios[3];
+    if (prepare_corpus(training) < 0) nob_return_defer(false);
+
+    // Cover the pooled and single-threaded loaders and the streaming
+    // pipeline; the generated calendars are each sorted.
+    const char *run_options[] = {"--threads", "1", "--threads", "4",
+                                 "--sorted", "--report"};
+    for (int run = 0; run < 3; run++) {
+        nob_cmd_append(&cmd, instrumented, run_options[2 * run],
+                       run_options[2 * run + 1], "-w", "08:00-18:00", "-m",
+                       "30");
+        for (int i = 0; i < training->calendars; i++) {
+            nob_cmd_append(&cmd, nob_temp_sprintf("%s/%s/cal%05d.csv",
+                                                  BENCH_DIR, training->name,
+                                                  i));
+        }
+        if (!nob_cmd_run(&cmd, .stdout_path = "/dev/null")) {
+            nob_return_defer(false);
+        }
+    }
+
+    flags.count = 0;
+    nob_cmd_append(&flags, "-O3", "-flto", nob_temp_sprintf("-march=%s", march),
+                   "-fprofile-use", "-fprofile-correction",
+                   "-Wno-missing-profile");
+    if (!build_variant(compiler, object_dir, PGO_DIR "/freeslots", &flags)) {
+        nob_return_defer(false);
+    }
+    nob_log(NOB_INFO, "Built " PGO_DIR "/freeslots");
+
+defer:
+    nob_cmd_free(flags);
+    nob_cmd_free(cmd);
+    return result;
+}
+
+typedef struct {
+    const char *name;
+    const char *flags[4];
+} MatrixOption;
+
+MatrixOption matrix_compilers[] = {{"gcc", {0}}, {"clang", {0}}};
+
+MatrixOption matrix_optimizations[] = {
+    {"O2", {"-O2"}},
+    {"O3", {"-O3"}},
+    {"O3-lto-native", {"-O3", "-flto", "-march=native"}},
+};
+
+// Engine knobs from the top of freeslots.c.
+MatrixOption matrix_engines[] = {
+    {"default", {0}},
+    {"run8k", {"-DPARALLEL_SORT_MIN_RUN=8192"}},
+    {"ranges2", {"-DPARALLEL_QUERY_RANGES_PER_THREAD=2"}},
+};
+
+typedef struct {
+    const char *name;
+    const char *compiler;
+    const char *object_dir;
+    const char *binary;
+    Nob_Cmd flags;
+    BenchResult results[NOB_ARRAY_LEN(bench_scenarios)];
+} MatrixVariant;
+
+bool compiler_available(const char *compiler) {
+    Nob_Cmd cmd = {0};
+    nob_cmd_append(&cmd, compiler, "--version");
+    bool ok = nob_cmd_run(&cmd, .stdout_path = "/dev/null",
+                          .stderr_path = "/dev/null");
+    nob_cmd_free(cmd);
+    return ok;
+}
+
+// Builds every compiler x optimization x engine combination, all compiles
+// running concurrently up to nob_nprocs(), then benchmarks each binary on the
+// corpora up to MAX_EVENTS and prints one comparison table.
+bool bench_matrix(long max_events) {
+    MatrixVariant variants[NOB_ARRAY_LEN(matrix_compilers) *
+                           NOB_ARRAY_LEN(matrix_optimizations) *
+                           NOB_ARRAY_LEN(matrix_engines)];
+    size_t variant_count = 0;
+    Nob_Procs procs = {0};
+    bool result = true;
+
+    if (!nob_mkdir_if_not_exists(MATRIX_DIR)) nob_return_defer(false);
+
+    for (size_t c = 0; c < NOB_ARRAY_LEN(matrix_compilers); c++) {
+        const char *compiler = matrix_compilers[c].name;
+        if (!compiler_available(compiler)) {
+            nob_log(NOB_WARNING, "Skipping %s: not installed", compiler);
+            continue;
+        }
+
+        for (size_t o = 0; o < NOB_ARRAY_LEN(matrix_optimizations); o++) {
+            for (size_t e = 0; e < NOB_ARRAY_LEN(matrix_engines); e++) {
+                MatrixVariant *variant = &variants[variant_count++];
+                memset(variant, 0, sizeof(MatrixVariant));
+                variant->compiler = compiler;
+                variant->name = nob_temp_sprintf(
+                    "%s-%s-%s", compiler, matrix_optimizations[o].name,
+                    matrix_engines[e].name);
+                variant->object_dir =
+                    nob_temp_sprintf("%s/%s", MATRIX_DIR, variant->name);
+                variant->binary =
+                    nob_temp_sprintf("%s/freeslots", variant->object_dir);
+
+                const MatrixOption *options[] = {&matrix_optimizations[o],
+                                                 &matrix_engines[e]};
+                for (size_t k = 0; k < NOB_ARRAY_LEN(options); k++) {
+                    for (size_t f = 0; f < NOB_ARRAY_LEN(options[k]->flags) &&
+                                       options[k]->flags[f];
+                         f++) {
+                        nob_cmd_append(&variant->flags, options[k]->flags[f]);
+                    }
+                }
+
+                if (!compile_variant(compiler, variant->object_dir,
+                                     &variant->flags, &procs)) {
+                    nob_return_defer(false);
+                }
+            }
+        }
+    }
+    if (variant_count == 0) {
+        nob_log(NOB_ERROR, "No compiler to build variants with; install gcc "
+                           "or clang");
+        nob_return_defer(false);
+    }
+    if (!nob_procs_flush(&procs)) nob_return_defer(false);
+
+    for (size_t v = 0; v < variant_count; v++) {
+        if (!link_variant(variants[v].compiler, variants[v].object_dir,
+                          variants[v].binary, &variants[v].flags, &procs)) {
+            nob_return_defer(false);
+        }
+    }
+    if (!nob_procs_flush(&procs)) nob_return_defer(false);
+
+    if (!build_generator()) nob_return_defer(false);
+    if (!nob_mkdir_if_not_exists(BENCH_DIR)) nob_return_defer(false);
+
+    size_t scenario_count = 0;
+    while (scenario_count < NOB_ARRAY_LEN(bench_scenarios) &&
+           bench_scenarios[scenario_count].target_events <= max_events) {
+        scenario_count++;
+    }
+
+    // Interleave the variants within each corpus so drift in machine load
+    // spreads over all of them instead of favouring the first.
+    for (size_t i = 0; i < scenario_count; i++) {
+        for (size_t v = 0; v < variant_count; v++) {
+            nob_log(NOB_INFO, "Timing %s on %s", variants[v].name,
+                    bench_scenarios[i].name);
+            if (!measure_scenario(&bench_scenarios[i], variants[v].binary,
+                                  &variants[v].results[i])) {
+                nob_return_defer(false);
+            }
+        }
+    }
+
+    printf("%-32s", "median ms");
+    for (size_t i = 0; i < scenario_count; i++) {
+        printf(" %10s", bench_scenarios[i].name);
+    }
+    printf(" %10s %10s\n", "peak MiB", "vs first");
+
+    const BenchResult *baseline = &variants[0].results[scenario_count - 1];
+    for (size_t v = 0; v < variant_count; v++) {
+        const BenchResult *largest = &variants[v].results[scenario_count - 1];
+        printf("%-32s", variants[v].name);
+        for (size_t i = 0; i < scenario_count; i++) {
+            printf(" %10.2f", variants[v].results[i].median * 1e3);
+        }
+        printf(" %10.1f %9.2fx\n", largest->max_rss_kb / 1024.0,
+               baseline->median / largest->median);
+    }
+
+defer:
+    // Compiles still queued after a failure are waited for, not leaked.
+    nob_procs_flush(&procs);
+    for (size_t v = 0; v < variant_count; v++) {
+        nob_cmd_free(variants[v].flags);
+    }
+    nob_da_free(procs);
+    return result;
+}
+
+// microbench.c includes freeslots.c to reach its static helpers. The CLI is
+// linked in with its main renamed so print_time_slot can be timed as well.
+bool build_microbench() {
+    Nob_Cmd cmd = {0};
+
+    if (!nob_mkdir_if_not_exists(BUILD_DIR)) return false;
+    if (!nob_mkdir_if_not_exists(MICROBENCH_DIR)) return false;
+
+    nob_cmd_append(&cmd, "cc", MAIN_CFLAGS, "-Dmain=freeslots_main", "-c",
+                   "-o", MICROBENCH_DIR "/calender_merge.o",
+                   "calender_merge.c");
+    if (!nob_cmd_run(&cmd)) return false;
+
+    nob_cmd_append(&cmd, "cc", MAIN_CFLAGS, "-pthread", "-o",
+                   MICROBENCH_DIR "/microbench", "microbench.c",
+                   MICROBENCH_DIR "/calender_merge.o", "cache.c",
+                   "discovery.c", "loader.c", "pipeline.c", "report.c",
+                   "stats.c", "perf.c", "trace.c", "pool.c", "kernels.c");
+    if (!nob_cmd_run(&cmd)) return false;
+
+    return true;
+}
+
+// A run of ./freeslots whose stdout must match TESTS_DIR/golden/GOLDEN.out,
+// or NAME.out when GOLDEN is NULL. REMOVE, if set, is deleted first.
+typedef struct {
+    const char *name;
+    const char *golden;
+    const char *remove;
+    const char *args[12];
+} GoldenTest;
+
+GoldenTest golden_tests[] = {
+    {"default", NULL, NULL,
+     {"-w", "08:15-17:00", "-m", "60", "cal1.csv", "cal2.csv", "cal3.csv"}},
+    {"queries", NULL, NULL,
+     {"--queries", TESTS_DIR "/queries.txt", "cal1.csv", "cal2.csv",
+      "cal3.csv"}},
+    {"manifest", NULL, NULL,
+     {"-w", "08:15-17:00", "-m", "30", "--manifest",
+      TESTS_DIR "/manifest.txt"}},
+    {"sorted", "default", NULL,
+     {"-w", "08:15-17:00", "-m", "60", "--sorted", "cal1.csv", "cal2.csv",
+      "cal3.csv"}},
+    {"skips", NULL, NULL,
+     {"-w", "08:15-17:00", "-m", "60", TESTS_DIR "/skips.csv", "cal1.csv"}},
+    {"skips-sorted", "skips", NULL,
+     {"-w", "08:15-17:00", "-m", "60", "--sorted", TESTS_DIR "/skips.csv",
+      "cal1.csv"}},
+    {"threads", "default", NULL,
+     {"-w", "08:15-17:00", "-m", "60", "--threads", "4", "cal1.csv",
+      "cal2.csv", "cal3.csv"}},
+    // Days past the end of February, which calendar rows may name, sit between
+    // the ranges the threads split the days into.
+    {"lenient", NULL, NULL,
+     {"-m", "60", "--threads", "1", TESTS_DIR "/lenient.csv"}},
+    {"lenient-threads", "lenient", NULL,
+     {"-m", "60", "--threads", "4", TESTS_DIR "/lenient.csv"}},
+    {"aggregate", NULL, NULL,
+     {"-w", "08:15-17:00", "--aggregate", "2025-09-08..2025-09-19",
+      "cal1.csv", "cal2.csv", "cal3.csv"}},
+    {"aggregate-lenient", NULL, NULL,
+     {"-w", "08:15-17:00", "--aggregate", "*", TESTS_DIR "/lenient.csv"}},
+    {"report", NULL, NULL,
+     {"-w", "08:15-17:00", "-m", "30", "--report", "cal1.csv", "cal2.csv",
+      "cal3.csv"}},
+    {"report-sorted", "report", NULL,
+     {"-w", "08:15-17:00", "-m", "30", "--report", "--sorted", "cal1.csv",
+      "cal2.csv", "cal3.csv"}},
+    // The tests run in order, so the hit replays what the miss stored.
+    {"cache-miss", "default", TEST_BUILD_DIR "/result.cache",
+     {"-w", "08:15-17:00", "-m", "60", "--cache",
+      TEST_BUILD_DIR "/result.cache", "cal1.csv", "cal2.csv", "cal3.csv"}},
+    {"cache-hit", "default", NULL,
+     {"-w", "08:15-17:00", "-m", "60", "--cache",
+      TEST_BUILD_DIR "/result.cache", "cal1.csv", "cal2.csv", "cal3.csv"}},
+    {"directory", NULL, NULL,
+     {"-w", "08:15-17:00", "-m", "60", TESTS_DIR "/calendars"}},
+    {"glob", "directory", NULL,
+     {"-w", "08:15-17:00", "-m", "60", TESTS_DIR "/calendars/cal*.csv"}},
+    {"io-uring", "default", NULL,
+     {"-w", "08:15-17:00", "-m", "60", "--loader", "io_uring", "cal1.csv",
+      "cal2.csv", "cal3.csv"}},
+    {"pread", "default", NULL,
+     {"-w", "08:15-17:00", "-m", "60", "--loader", "pread", "cal1.csv",
+      "cal2.csv", "cal3.csv"}},
+};
+
+bool files_equal(const char *path1, const char *path2) {
+    Nob_String_Builder sb1 = {0};
+    Nob_String_Builder sb2 = {0};
+    bool equal = nob_read_entire_file(path1, &sb1) &&
+                 nob_read_entire_file(path2, &sb2) &&
+                 sb1.count == sb2.count &&
+                 memcmp(sb1.items, sb2.items, sb1.count) == 0;
+    nob_sb_free(sb1);
+    nob_sb_free(sb2);
+    return equal;
+}
+
+// With UPDATE, tests that own their golden file rewrite it instead.
+bool run_golden_test(const GoldenTest *test, bool update) {
+    const char *golden = nob_temp_sprintf(TESTS_DIR "/golden/%s.out",
+                                          test->golden ? test->golden
+                                                       : test->name);
+    bool rewrite = update && !test->golden;
+    const char *output =
+        rewrite ? golden
+                : nob_temp_sprintf(TEST_BUILD_DIR "/%s.out", test->name);
+
+    if (test->remove && nob_file_exists(test->remove) == 1 &&
+        !nob_delete_file(test->remove)) {
+        return false;
+    }
+
+    Nob_Cmd cmd = {0};
+    nob_cmd_append(&cmd, "./freeslots");
+    for (size_t i = 0; i < NOB_ARRAY_LEN(test->args) && test->args[i]; i++) {
+        nob_cmd_append(&cmd, test->args[i]);
+    }
+    bool ok = nob_cmd_run(&cmd, .stdout_path = output,
+                          .stderr_path = "/dev/null");
+    if (!ok || rewrite) {
+        nob_cmd_free(cmd);
+        return ok;
+    }
+
+    ok = files_equal(golden, output);
+    if (!ok) {
+        nob_log(NOB_ERROR, "%s: output differs from %s", test->name, golden);
+        nob_cmd_append(&cmd, "diff", "-u", golden, output);
+        nob_cmd_run(&cmd);
+    }
+    nob_cmd_free(cmd);
+    return ok;
+}
+
+// tests/unit.c includes freeslots.c, like microbench.c, to check its static
+// fast paths against the code they replace.
+bool build_unit_tests() {
+    Nob_Cmd cmd = {0};
+
+    if (!nob_mkdir_if_not_exists(BUILD_DIR)) return false;
+    if (!nob_mkdir_if_not_exists(TEST_BUILD_DIR)) return false;
+
+    nob_cmd_append(&cmd, "cc", MAIN_CFLAGS, "-pthread", "-o",
+                   TEST_BUILD_DIR "/unit", TESTS_DIR "/unit.c", "kernels.c",
+                   "pool.c");
+    return nob_cmd_run(&cmd);
+}
+
+// Builds ./freeslots and the unit tests, then runs every golden test and the
+// unit tests, reporting all failures before failing.
+bool test(bool update) {
+    if (!build_main_executable()) return false;
+    if (!build_unit_tests()) return false;
+
+    int failures = 0;
+    for (size_t i = 0; i < NOB_ARRAY_LEN(golden_tests); i++) {
+        if (!run_golden_test(&golden_tests[i], update)) failures++;
+    }
+
+    if (failures > 0) {
+        nob_log(NOB_ERROR, "%d of %zu golden tests failed", failures,
+                NOB_ARRAY_LEN(golden_tests));
+    } else {
+        nob_log(NOB_INFO, "All %zu golden tests passed",
+                NOB_ARRAY_LEN(golden_tests));
+    }
+
+    Nob_Cmd cmd = {0};
+    nob_cmd_append(&cmd, TEST_BUILD_DIR "/unit");
+    if (!nob_cmd_run(&cmd)) failures++;
+    return failures == 0;
+}
+
 bool clean() {
     nob_log(NOB_INFO, "Cleaning up...");
 
@@ -21,6 +1143,12 @@ bool clean() {
         if (!nob_cmd_run(&cmd)) return false;
     }
 
+    if (nob_file_exists(BUILD_DIR)) {
+        Nob_Cmd cmd = {0};
+        nob_cmd_append(&cmd, "rm", "-r", BUILD_DIR);
+        if (!nob_cmd_run(&cmd)) return false;
+    }
+
     if (nob_file_exists("nob.old")) {
         Nob_Cmd cmd = {0};
         nob_cmd_append(&cmd, "rm", "nob.old");
@@ -40,6 +1168,14 @@ void usage(const char *program) {
     nob_log(NOB_INFO, "Usage: %s [SUBCOMMAND]", program);
     nob_log(NOB_INFO, "  SUBCOMMANDS:");
     nob_log(NOB_INFO, "    main                   - Build main executable");
+    nob_log(NOB_INFO, "    lib                    - Build libfreeslots (static and shared)");
+    nob_log(NOB_INFO, "    release [MARCH]        - Build an LTO executable in " RELEASE_DIR " (default -march=native)");
+    nob_log(NOB_INFO, "    pgo [MARCH]            - Build, train and rebuild with a gcc profile in " PGO_DIR);
+    nob_log(NOB_INFO, "    bench [MAX_EVENTS] [BINARY...] - Benchmark generated corpora up to MAX_EVENTS (default 1M, max 100M)");
+    nob_log(NOB_INFO, "    bench-compare [REVISION] [MAX_EVENTS] [--threshold=PCT] - Fail if ./freeslots got slower than the stored baseline");
+    nob_log(NOB_INFO, "    bench-matrix [MAX_EVENTS] - Build compiler x -O x engine variants in parallel and compare them (default 100K)");
+    nob_log(NOB_INFO, "    microbench [ARGS...]   - Build and run the helper microbenchmarks in " MICROBENCH_DIR);
+    nob_log(NOB_INFO, "    test [update]          - Check ./freeslots against the golden outputs in " TESTS_DIR "/golden (update rewrites them) and run the unit tests");
     nob_log(NOB_INFO, "    clean                  - Clean build artifacts");
 }
 
@@ -57,6 +1193,58 @@ int main(int argc, char **argv) {
 
     if (strcmp(subcommand, "main") == 0) {
         if (!build_main_executable()) return 1;
+    } else if (strcmp(subcommand, "lib") == 0) {
+        if (!build_library()) return 1;
+    } else if (strcmp(subcommand, "release") == 0) {
+        if (!build_release(argc > 0 ? argv[0] : "native")) return 1;
+    } else if (strcmp(subcommand, "pgo") == 0) {
+        if (!build_pgo(argc > 0 ? argv[0] : "native")) return 1;
+    } else if (strcmp(subcommand, "microbench") == 0) {
+        if (!build_microbench()) return 1;
+        Nob_Cmd cmd = {0};
+        nob_cmd_append(&cmd, MICROBENCH_DIR "/microbench");
+        nob_da_append_many(&cmd, argv, argc);
+        if (!nob_cmd_run(&cmd)) return 1;
+    } else if (strcmp(subcommand, "bench") == 0) {
+        long max_events = 1000000L;
+        if (argc > 0 && isdigit((unsigned char)argv[0][0])) {
+            max_events = parse_event_count(nob_shift(argv, argc));
+            if (max_events < 0) {
+                nob_log(NOB_ERROR, "Invalid event count");
+                usage(program);
+                return 1;
+            }
+        }
+        BenchContext context;
+        init_bench_context(&context);
+        if (!bench(max_events, (const char **)argv, argc, &context)) return 1;
+    } else if (strcmp(subcommand, "bench-compare") == 0) {
+        const char *revision = NULL;
+        long max_events = 1000000L;
+        double threshold = 0.05;
+        while (argc > 0) {
+            const char *arg = nob_shift(argv, argc);
+            if (strncmp(arg, "--threshold=", 12) == 0) {
+                threshold = atof(arg + 12) / 100;
+            } else if (parse_event_count(arg) > 0) {
+                max_events = parse_event_count(arg);
+            } else {
+                revision = arg;
+            }
+        }
+        if (!bench_compare(revision, max_events, threshold)) return 1;
+    } else if (strcmp(subcommand, "bench-matrix") == 0) {
+        long max_events =
+            argc > 0 ? parse_event_count(nob_shift(argv, argc)) : 100000L;
+        if (max_events < 1000) {
+            nob_log(NOB_ERROR, "Invalid event count");
+            usage(program);
+            return 1;
+        }
+        if (!bench_matrix(max_events)) return 1;
+    } else if (strcmp(subcommand, "test") == 0) {
+        bool update = argc > 0 && strcmp(argv[0], "update") == 0;
+        if (!test(update)) return 1;
     } else if (strcmp(subcommand, "clean") == 0) {
         if (!clean()) return 1;
     } else {
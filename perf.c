@@ -0,0 +1,142 @@
+#define _GNU_SOURCE
+
+#include "perf.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+struct PerfCounters {
+    // -1 for a counter that could not be opened.
+    int fds[PERF_COUNTER_COUNT];
+};
+
+#ifdef __linux__
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} counter_events[PERF_COUNTER_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+// Counters are inherited by the threads created after they are opened, and a
+// read sums all of them. The kernel cannot read an inherited group in one go,
+// so each counter is a separate event.
+static int open_counter(PerfCounter counter) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_events[counter].type;
+    attr.config = counter_events[counter].config;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    // User space only, which an unprivileged process may count at
+    // perf_event_paranoid 2.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+PerfCounters *perf_counters_open(void) {
+    PerfCounters *counters = malloc(sizeof(PerfCounters));
+    int opened = 0;
+    int first_errno = 0;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        counters->fds[i] = open_counter(i);
+        if (counters->fds[i] < 0) {
+            if (!first_errno) first_errno = errno;
+            continue;
+        }
+        opened++;
+    }
+
+    if (opened == 0) {
+        fprintf(stderr, "Warning: performance counters unavailable (%s); "
+                        "check /proc/sys/kernel/perf_event_paranoid\n",
+                strerror(first_errno));
+        free(counters);
+        return NULL;
+    }
+    if (counters->fds[PERF_CYCLES] < 0) {
+        fprintf(stderr, "Warning: hardware counters unavailable (%s)\n",
+                first_errno == ENOENT ? "no PMU on this CPU or VM"
+                                      : strerror(first_errno));
+    }
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (counters->fds[i] < 0) continue;
+        ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+    return counters;
+}
+
+void perf_counters_close(PerfCounters *counters) {
+    if (!counters) return;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (counters->fds[i] >= 0) close(counters->fds[i]);
+    }
+    free(counters);
+}
+
+int perf_counters_read(PerfCounters *counters, PerfSample *sample) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        sample->values[i] = 0;
+        if (counters->fds[i] < 0) continue;
+
+        // value, time_enabled, time_running
+        uint64_t buffer[3];
+        if (read(counters->fds[i], buffer, sizeof(buffer)) !=
+            sizeof(buffer)) {
+            return 0;
+        }
+        double scale = buffer[2] ? (double)buffer[1] / buffer[2] : 0;
+        sample->values[i] = buffer[0] * scale;
+    }
+    return 1;
+}
+
+#else
+
+PerfCounters *perf_counters_open(void) {
+    fprintf(stderr, "Warning: hardware counters need Linux perf_event_open\n");
+    return NULL;
+}
+
+void perf_counters_close(PerfCounters *counters) {
+    (void)counters;
+}
+
+int perf_counters_read(PerfCounters *counters, PerfSample *sample) {
+    (void)counters;
+    (void)sample;
+    return 0;
+}
+
+#endif
+
+int perf_counters_available(const PerfCounters *counters, PerfCounter counter) {
+    return counters->fds[counter] >= 0;
+}
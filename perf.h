@@ -0,0 +1,36 @@
+#ifndef PERF_H
+#define PERF_H
+
+// Hardware counters for --perf-counters, opened with perf_event_open on the
+// calling thread and inherited by every thread it starts afterwards, so a
+// read covers the whole process. Counters the CPU or kernel does not provide
+// are left out; page faults are a software counter and stay available inside
+// most VMs.
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_PAGE_FAULTS,
+    PERF_COUNTER_COUNT
+} PerfCounter;
+
+typedef struct {
+    double values[PERF_COUNTER_COUNT];
+} PerfSample;
+
+typedef struct PerfCounters PerfCounters;
+
+// Returns NULL, after printing why to stderr, when no counter can be opened.
+PerfCounters *perf_counters_open(void);
+void perf_counters_close(PerfCounters *counters);
+
+int perf_counters_available(const PerfCounters *counters, PerfCounter counter);
+
+// Reads the running totals, each scaled up if the kernel had to multiplex
+// it. Returns 0 if the read failed.
+int perf_counters_read(PerfCounters *counters, PerfSample *sample);
+
+#endif  // PERF_H
@@ -0,0 +1,479 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pipeline.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Bytes read per chunk are split between the files, within these bounds, so
+// the rows held in memory stay about the same however many files there are.
+#define PIPELINE_READ_BUDGET (16 << 20)
+#define PIPELINE_MAX_CHUNK_SIZE (1 << 20)
+#define PIPELINE_MIN_CHUNK_SIZE (16 << 10)
+
+// How many chunks the reader may have read ahead of the parser.
+#define PIPELINE_BLOCK_COUNT 4
+
+// Puts a thread to sleep until another one publishes progress. Publishing is
+// a sequentially consistent store followed by parker_wake, and waiting
+// re-checks the condition after announcing itself, so either the waiter sees
+// the store or the publisher sees the waiter; the fast path never locks.
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int sleepers;
+} Parker;
+
+typedef struct {
+    void **slots;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+    Parker parker;
+} SpscRing;
+
+typedef struct {
+    FreeSlotsEvent *events;
+    int count;
+    int capacity;
+} Batch;
+
+// One input file. The parser fills `spare` while the merger works through
+// `current`; counting up `handed` hands the spare batch over, and the merger
+// asks for the next one by pushing the lane onto the request ring.
+typedef struct {
+    const char *path;
+    void *skip_data;
+
+    // Owned by the reader.
+    off_t offset;
+    int at_end;
+
+    // Owned by the parser.
+    int line_number;
+    int unsorted;
+    FreeSlotsDate last_start;
+
+    // Written by the parser before `handed` is counted up.
+    Batch spare;
+    int spare_is_last;
+    int failed;
+    size_t handed;
+
+    // Owned by the merger.
+    Batch current;
+    int position;
+    int is_last;
+    size_t taken;
+} Lane;
+
+// A chunk of one lane's file, cut at its last whole line, on its way from
+// the reader to the parser.
+typedef struct {
+    Lane *lane;
+    char *data;
+    size_t size;
+    size_t capacity;
+    int at_end;
+    int failed;
+} Block;
+
+typedef struct {
+    Lane *lanes;
+    int lane_count;
+    int stop;
+
+    // Lanes the merger wants a chunk of, blocks the reader has filled, and
+    // blocks the parser is done with. The block rings bound the read-ahead.
+    SpscRing requests;
+    SpscRing full_blocks;
+    SpscRing free_blocks;
+    Block blocks[PIPELINE_BLOCK_COUNT];
+    size_t chunk_size;
+
+    // Woken whenever the parser hands a lane's batch over.
+    Parker parsed;
+
+    Lane *filling;
+    FreeSlotsSkipCallback on_skip;
+
+    // The reader adds the bytes and the parser the rows.
+    Stats *stats;
+} Pipeline;
+
+static void parker_init(Parker *parker) {
+    pthread_mutex_init(&parker->mutex, NULL);
+    pthread_cond_init(&parker->cond, NULL);
+    parker->sleepers = 0;
+}
+
+static void parker_destroy(Parker *parker) {
+    pthread_mutex_destroy(&parker->mutex);
+    pthread_cond_destroy(&parker->cond);
+}
+
+static void parker_wake(Parker *parker) {
+    if (__atomic_load_n(&parker->sleepers, __ATOMIC_SEQ_CST) == 0) return;
+    pthread_mutex_lock(&parker->mutex);
+    pthread_cond_broadcast(&parker->cond);
+    pthread_mutex_unlock(&parker->mutex);
+}
+
+// Sleeps until *value differs from `seen`.
+static void parker_wait(Parker *parker, const size_t *value, size_t seen) {
+    while (__atomic_load_n(value, __ATOMIC_SEQ_CST) == seen) {
+        pthread_mutex_lock(&parker->mutex);
+        __atomic_add_fetch(&parker->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(value, __ATOMIC_SEQ_CST) == seen) {
+            pthread_cond_wait(&parker->cond, &parker->mutex);
+        }
+        __atomic_sub_fetch(&parker->sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&parker->mutex);
+    }
+}
+
+static void spsc_ring_init(SpscRing *ring, size_t capacity) {
+    ring->slots = malloc(sizeof(void *) * capacity);
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    parker_init(&ring->parker);
+}
+
+static void spsc_ring_destroy(SpscRing *ring) {
+    free(ring->slots);
+    parker_destroy(&ring->parker);
+}
+
+// The producer owns `head` and the consumer owns `tail`; each side only
+// publishes its own index. A full ring blocks the producer and an empty one
+// the consumer, so neither runs ahead by more than the capacity.
+void spsc_ring_push(SpscRing *ring, void *item) {
+    size_t head = ring->head;
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == ring->capacity) {
+        parker_wait(&ring->parker, &ring->tail, tail);
+    }
+
+    ring->slots[head % ring->capacity] = item;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+    parker_wake(&ring->parker);
+}
+
+void *spsc_ring_pop(SpscRing *ring) {
+    size_t tail = ring->tail;
+    parker_wait(&ring->parker, &ring->head, tail);
+
+    void *item = ring->slots[tail % ring->capacity];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    parker_wake(&ring->parker);
+    return item;
+}
+
+void add_event_to_lane(const FreeSlotsEvent *event, void *user_data) {
+    Pipeline *pipeline = user_data;
+    Lane *lane = pipeline->filling;
+    pipeline->stats->rows_read++;
+
+    if (lane->unsorted) return;
+    if (freeslots_compare_dates(event->start_date, lane->last_start) < 0) {
+        lane->unsorted = 1;
+        return;
+    }
+    lane->last_start = event->start_date;
+
+    Batch *batch = &lane->spare;
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 256;
+        batch->events =
+            realloc(batch->events, sizeof(FreeSlotsEvent) * batch->capacity);
+    }
+    batch->events[batch->count++] = *event;
+}
+
+void report_skipped_line(int line_number, const char *reason,
+                         const char *field, void *user_data) {
+    Pipeline *pipeline = user_data;
+    pipeline->stats->rows_read++;
+    pipeline->on_skip(line_number, reason, field,
+                      pipeline->filling->skip_data);
+}
+
+// Reads the lane's next chunk, cut at the last whole line, into `block`. The
+// file is opened per chunk so that any number of lanes can be open at once.
+// Returns 0 if the file cannot be read.
+static int read_chunk(Pipeline *pipeline, Lane *lane, Block *block) {
+    block->size = 0;
+    if (lane->at_end) return 1;
+
+    int fd = open(lane->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open file: %s\n", lane->path);
+        return 0;
+    }
+
+    trace_begin("read chunk", lane->path);
+    size_t wanted = pipeline->chunk_size;
+    size_t size = 0;
+    size_t send_size = 0;
+    for (;;) {
+        if (wanted > block->capacity) {
+            block->capacity = wanted;
+            block->data = realloc(block->data, wanted);
+        }
+        ssize_t bytes_read = pread(fd, block->data + size, wanted - size,
+                                   lane->offset + size);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read < 0) {
+            fprintf(stderr, "Cannot read file: %s\n", lane->path);
+            close(fd);
+            trace_end("bytes", size);
+            return 0;
+        }
+        size += bytes_read;
+        if (bytes_read == 0) {
+            lane->at_end = 1;
+            send_size = size;
+            break;
+        }
+        if (size < wanted) continue;
+
+        // A line longer than the chunk is read whole into a larger one.
+        for (size_t i = size; i > 0; i--) {
+            if (block->data[i - 1] == '\n') {
+                send_size = i;
+                break;
+            }
+        }
+        if (send_size > 0) break;
+        wanted *= 2;
+    }
+    close(fd);
+    trace_end("bytes", size);
+
+    lane->offset += send_size;
+    pipeline->stats->bytes_read += send_size;
+    block->size = send_size;
+    return 1;
+}
+
+void *reader_stage(void *arg) {
+    Pipeline *pipeline = arg;
+
+    trace_name_thread("reader");
+
+    for (;;) {
+        Lane *lane = spsc_ring_pop(&pipeline->requests);
+        if (!lane) {
+            spsc_ring_push(&pipeline->full_blocks, NULL);
+            return NULL;
+        }
+
+        // After a failure the remaining requests are answered empty.
+        Block *block = spsc_ring_pop(&pipeline->free_blocks);
+        block->lane = lane;
+        block->size = 0;
+        block->failed = 0;
+        if (!__atomic_load_n(&pipeline->stop, __ATOMIC_ACQUIRE)) {
+            block->failed = !read_chunk(pipeline, lane, block);
+        }
+        block->at_end = lane->at_end;
+        spsc_ring_push(&pipeline->full_blocks, block);
+    }
+}
+
+// Parses each block into its lane's spare batch and hands the batch to the
+// merger. A lane whose rows go back in time fails.
+void *parser_stage(void *arg) {
+    Pipeline *pipeline = arg;
+
+    trace_name_thread("parser");
+
+    for (;;) {
+        Block *block = spsc_ring_pop(&pipeline->full_blocks);
+        if (!block) return NULL;
+
+        Lane *lane = block->lane;
+        lane->spare.count = 0;
+        lane->failed = block->failed;
+        if (!lane->failed && block->size > 0) {
+            trace_begin("parse chunk", NULL);
+            pipeline->filling = lane;
+            lane->line_number += freeslots_parse_csv(
+                block->data, block->size, lane->line_number,
+                pipeline->stats->isa, add_event_to_lane, report_skipped_line,
+                pipeline);
+            trace_end("rows", lane->spare.count);
+
+            if (lane->unsorted) {
+                fprintf(stderr,
+                        "Error: %s is not sorted by start date; run without "
+                        "--sorted\n",
+                        lane->path);
+                lane->failed = 1;
+            }
+        }
+        lane->spare_is_last = block->at_end;
+        spsc_ring_push(&pipeline->free_blocks, block);
+
+        __atomic_store_n(&lane->handed, lane->handed + 1, __ATOMIC_SEQ_CST);
+        parker_wake(&pipeline->parsed);
+    }
+}
+
+// Makes `current` hold the lane's next row, asking for the chunk after it as
+// soon as a chunk is taken, or sets `is_last` once the file is done. Returns
+// 0 if the lane failed.
+static int advance_lane(Pipeline *pipeline, Lane *lane) {
+    while (lane->position == lane->current.count && !lane->is_last) {
+        parker_wait(&pipeline->parsed, &lane->handed, lane->taken++);
+        if (lane->failed) return 0;
+
+        Batch taken = lane->spare;
+        lane->spare = lane->current;
+        lane->current = taken;
+        lane->position = 0;
+        lane->is_last = lane->spare_is_last;
+        if (!lane->is_last) spsc_ring_push(&pipeline->requests, lane);
+    }
+    return 1;
+}
+
+static int lane_before(const Lane *lane1, const Lane *lane2) {
+    const FreeSlotsEvent *event1 = &lane1->current.events[lane1->position];
+    const FreeSlotsEvent *event2 = &lane2->current.events[lane2->position];
+    int order =
+        freeslots_compare_dates(event1->start_date, event2->start_date);
+    if (order != 0) return order < 0;
+    return event1->start_minutes < event2->start_minutes;
+}
+
+static void sift_down(Lane **heap, int count, int index) {
+    for (;;) {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+        if (left < count && lane_before(heap[left], heap[smallest])) {
+            smallest = left;
+        }
+        if (right < count && lane_before(heap[right], heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == index) return;
+
+        Lane *swap = heap[index];
+        heap[index] = heap[smallest];
+        heap[smallest] = swap;
+        index = smallest;
+    }
+}
+
+int run_sorted_pipeline(const char *const *paths, int path_count,
+                        FreeSlotsConfig config, FreeSlotsSlotCallback on_slot,
+                        FreeSlotsDayCallback on_day, void *user_data,
+                        FreeSlotsSkipCallback on_skip, void *const *skip_data,
+                        long *event_count, Stats *stats) {
+    Pipeline *pipeline = calloc(1, sizeof(Pipeline));
+    pipeline->lanes = calloc(path_count, sizeof(Lane));
+    pipeline->lane_count = path_count;
+    pipeline->on_skip = on_skip;
+    pipeline->stats = stats;
+    parker_init(&pipeline->parsed);
+
+    // Every lane has at most one request outstanding, plus the final NULL,
+    // which the reader passes on to the parser.
+    spsc_ring_init(&pipeline->requests, path_count + 1);
+    spsc_ring_init(&pipeline->full_blocks, PIPELINE_BLOCK_COUNT + 1);
+    spsc_ring_init(&pipeline->free_blocks, PIPELINE_BLOCK_COUNT);
+    for (int i = 0; i < PIPELINE_BLOCK_COUNT; i++) {
+        spsc_ring_push(&pipeline->free_blocks, &pipeline->blocks[i]);
+    }
+
+    size_t chunk_size = PIPELINE_READ_BUDGET / (path_count ? path_count : 1);
+    if (chunk_size > PIPELINE_MAX_CHUNK_SIZE) {
+        chunk_size = PIPELINE_MAX_CHUNK_SIZE;
+    }
+    if (chunk_size < PIPELINE_MIN_CHUNK_SIZE) {
+        chunk_size = PIPELINE_MIN_CHUNK_SIZE;
+    }
+    pipeline->chunk_size = chunk_size;
+
+    for (int i = 0; i < path_count; i++) {
+        Lane *lane = &pipeline->lanes[i];
+        lane->path = paths[i];
+        lane->skip_data = skip_data[i];
+        lane->line_number = 1;
+        spsc_ring_push(&pipeline->requests, lane);
+    }
+
+    pthread_t reader, parser;
+    pthread_create(&reader, NULL, reader_stage, pipeline);
+    pthread_create(&parser, NULL, parser_stage, pipeline);
+
+    FreeSlotsSweep *sweep = freeslots_sweep_create(config, on_slot, user_data);
+    freeslots_sweep_set_day_callback(sweep, on_day);
+    freeslots_sweep_set_isa(sweep, stats->isa);
+    Lane **heap = malloc(sizeof(Lane *) * (path_count ? path_count : 1));
+    int heap_count = 0;
+    int ok = 1;
+
+    for (int i = 0; i < path_count && ok; i++) {
+        Lane *lane = &pipeline->lanes[i];
+        ok = advance_lane(pipeline, lane);
+        if (ok && lane->position < lane->current.count) {
+            heap[heap_count++] = lane;
+        }
+    }
+    for (int i = heap_count / 2 - 1; i >= 0; i--) {
+        sift_down(heap, heap_count, i);
+    }
+
+    // Each file is sorted by start date on its own, so always taking the
+    // earliest head row feeds the sweep in start date order.
+    trace_begin("merge", NULL);
+    long rows = 0;
+    while (heap_count > 0 && ok) {
+        Lane *lane = heap[0];
+        freeslots_sweep_add_event(sweep,
+                                  &lane->current.events[lane->position++]);
+        rows++;
+
+        ok = advance_lane(pipeline, lane);
+        if (lane->position == lane->current.count) {
+            heap[0] = heap[--heap_count];
+        }
+        sift_down(heap, heap_count, 0);
+    }
+    trace_end("rows", rows);
+
+    __atomic_store_n(&pipeline->stop, 1, __ATOMIC_RELEASE);
+    spsc_ring_push(&pipeline->requests, NULL);
+    pthread_join(reader, NULL);
+    pthread_join(parser, NULL);
+
+    if (ok) freeslots_sweep_finish(sweep);
+    *event_count = freeslots_sweep_event_count(sweep);
+    freeslots_sweep_destroy(sweep);
+
+    for (int i = 0; i < path_count; i++) {
+        free(pipeline->lanes[i].current.events);
+        free(pipeline->lanes[i].spare.events);
+    }
+    for (int i = 0; i < PIPELINE_BLOCK_COUNT; i++) {
+        free(pipeline->blocks[i].data);
+    }
+    free(heap);
+    free(pipeline->lanes);
+    spsc_ring_destroy(&pipeline->requests);
+    spsc_ring_destroy(&pipeline->full_blocks);
+    spsc_ring_destroy(&pipeline->free_blocks);
+    parker_destroy(&pipeline->parsed);
+    free(pipeline);
+    return ok;
+}
@@ -0,0 +1,25 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "freeslots.h"
+#include "stats.h"
+
+// Streams free slots for input files that are each sorted by start date. A
+// reader thread reads the files a chunk at a time and a parser thread turns
+// the chunks into rows, each staying at most a few chunks ahead of the next
+// stage, while the calling thread merges the files' rows in start order and
+// emits each day once no later row can reach it. Chunks shrink as files are
+// added, so memory stays bounded however many files there are.
+//
+// `on_day`, which may be NULL, is called for each day ahead of its slots.
+// Skipped rows of file i go to `on_skip` with `skip_data[i]`, from the parser
+// thread. Parses and merges with the kernels `stats->isa` names, if set.
+// Bytes and rows are added to `stats`. Returns 0 if a file cannot be read or
+// is not sorted; slots already emitted are then incomplete.
+int run_sorted_pipeline(const char *const *paths, int path_count,
+                        FreeSlotsConfig config, FreeSlotsSlotCallback on_slot,
+                        FreeSlotsDayCallback on_day, void *user_data,
+                        FreeSlotsSkipCallback on_skip, void *const *skip_data,
+                        long *event_count, Stats *stats);
+
+#endif  // PIPELINE_H
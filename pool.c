@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+
+#include "pool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+    FreeSlotsTask task;
+    void *arg;
+    FreeSlotsTaskGroup *group;
+} PoolTask;
+
+typedef struct {
+    FreeSlotsPool *pool;
+    int index;
+    pthread_t thread;
+    unsigned int seed;
+
+    pthread_mutex_t lock;
+    PoolTask *tasks;
+    long top;
+    long bottom;
+    long capacity;
+} PoolWorker;
+
+struct FreeSlotsPool {
+    PoolWorker *workers;
+    int worker_count;
+    int pin_threads;
+    pthread_key_t current_worker;
+
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    long queued;
+    unsigned int next_worker;
+    int stopping;
+};
+
+static unsigned int next_random(unsigned int *seed) {
+    unsigned int x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+static void push_bottom(PoolWorker *worker, PoolTask task) {
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->bottom - worker->top == worker->capacity) {
+        long capacity = worker->capacity ? worker->capacity * 2 : 64;
+        PoolTask *tasks = malloc(sizeof(PoolTask) * capacity);
+        for (long i = worker->top; i < worker->bottom; i++) {
+            tasks[i % capacity] = worker->tasks[i % worker->capacity];
+        }
+        free(worker->tasks);
+        worker->tasks = tasks;
+        worker->capacity = capacity;
+    }
+
+    worker->tasks[worker->bottom % worker->capacity] = task;
+    worker->bottom++;
+    pthread_mutex_unlock(&worker->lock);
+}
+
+static int pop_bottom(PoolWorker *worker, PoolTask *task) {
+    pthread_mutex_lock(&worker->lock);
+
+    int found = worker->bottom > worker->top;
+    if (found) {
+        worker->bottom--;
+        *task = worker->tasks[worker->bottom % worker->capacity];
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+static int steal_top(PoolWorker *worker, PoolTask *task) {
+    pthread_mutex_lock(&worker->lock);
+
+    int found = worker->bottom > worker->top;
+    if (found) {
+        *task = worker->tasks[worker->top % worker->capacity];
+        worker->top++;
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+static int steal_any(FreeSlotsPool *pool, unsigned int *seed,
+                     PoolTask *task) {
+    int start = next_random(seed) % pool->worker_count;
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        if (steal_top(&pool->workers[(start + i) % pool->worker_count],
+                      task)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int take_task(FreeSlotsPool *pool, PoolWorker *worker,
+                     unsigned int *seed, PoolTask *task) {
+    if ((worker && pop_bottom(worker, task)) || steal_any(pool, seed, task)) {
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+        return 1;
+    }
+    return 0;
+}
+
+static void run_task(PoolTask task) {
+    task.task(task.arg);
+    __atomic_sub_fetch(&task.group->pending, 1, __ATOMIC_RELEASE);
+}
+
+static void pin_worker(PoolWorker *worker) {
+#ifdef __linux__
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count < 1) return;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->index % cpu_count, &cpus);
+    pthread_setaffinity_np(worker->thread, sizeof(cpus), &cpus);
+#else
+    (void)worker;
+#endif
+}
+
+static void *worker_main(void *arg) {
+    PoolWorker *worker = arg;
+    FreeSlotsPool *pool = worker->pool;
+
+    pthread_setspecific(pool->current_worker, worker);
+    if (pool->pin_threads) pin_worker(worker);
+
+    for (;;) {
+        PoolTask task;
+        if (take_task(pool, worker, &worker->seed, &task)) {
+            run_task(task);
+            continue;
+        }
+
+        // `queued` is raised before the wake-up is signalled under
+        // sleep_lock, so checking it under the same lock cannot miss a task.
+        pthread_mutex_lock(&pool->sleep_lock);
+        while (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0 &&
+               !pool->stopping) {
+            pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        }
+        int stopping = pool->stopping;
+        pthread_mutex_unlock(&pool->sleep_lock);
+
+        if (stopping) return NULL;
+    }
+}
+
+FreeSlotsPool *freeslots_pool_create(int thread_count, int pin_threads) {
+    if (thread_count < 1) thread_count = 1;
+
+    FreeSlotsPool *pool = calloc(1, sizeof(FreeSlotsPool));
+    pool->worker_count = thread_count;
+    pool->pin_threads = pin_threads;
+    pool->workers = calloc(thread_count, sizeof(PoolWorker));
+    pthread_key_create(&pool->current_worker, NULL);
+    pthread_mutex_init(&pool->sleep_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    for (int i = 0; i < thread_count; i++) {
+        PoolWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->seed = 2463534242u + 7919u * i;
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_create(&pool->workers[i].thread, NULL, worker_main,
+                       &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+void freeslots_pool_destroy(FreeSlotsPool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->sleep_lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        free(pool->workers[i].tasks);
+    }
+
+    pthread_key_delete(pool->current_worker);
+    pthread_mutex_destroy(&pool->sleep_lock);
+    pthread_cond_destroy(&pool->wake);
+    free(pool->workers);
+    free(pool);
+}
+
+int freeslots_pool_thread_count(const FreeSlotsPool *pool) {
+    return pool->worker_count;
+}
+
+void freeslots_pool_submit(FreeSlotsPool *pool, FreeSlotsTaskGroup *group,
+                           FreeSlotsTask task, void *arg) {
+    PoolWorker *worker = pthread_getspecific(pool->current_worker);
+    if (!worker) {
+        unsigned int next =
+            __atomic_fetch_add(&pool->next_worker, 1, __ATOMIC_RELAXED);
+        worker = &pool->workers[next % pool->worker_count];
+    }
+
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+    push_bottom(worker, (PoolTask){task, arg, group});
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&pool->sleep_lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+}
+
+void freeslots_pool_wait(FreeSlotsPool *pool, FreeSlotsTaskGroup *group) {
+    PoolWorker *worker = pthread_getspecific(pool->current_worker);
+    unsigned int seed = worker ? worker->seed + 1 : 88172645u;
+
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+        PoolTask task;
+        if (take_task(pool, worker, &seed, &task)) {
+            run_task(task);
+        } else {
+            sched_yield();
+        }
+    }
+}
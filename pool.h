@@ -0,0 +1,34 @@
+#ifndef POOL_H
+#define POOL_H
+
+// Work-stealing thread pool used by every parallel phase of libfreeslots.
+//
+// Each worker owns a deque: it pushes and pops its own tasks at the bottom,
+// and idle workers steal from the top of a randomly chosen victim. Tasks may
+// submit further tasks and wait on them; a thread that waits keeps running
+// queued tasks instead of blocking, so nested parallelism cannot deadlock.
+
+typedef struct FreeSlotsPool FreeSlotsPool;
+
+typedef void (*FreeSlotsTask)(void *arg);
+
+// Counts the unfinished tasks submitted against it. Zero-initialize before
+// the first submit.
+typedef struct {
+    long pending;
+} FreeSlotsTaskGroup;
+
+// Starts `thread_count` workers. With `pin_threads` set, worker i is bound to
+// CPU i modulo the number of online CPUs where the platform allows it.
+FreeSlotsPool *freeslots_pool_create(int thread_count, int pin_threads);
+void freeslots_pool_destroy(FreeSlotsPool *pool);
+
+int freeslots_pool_thread_count(const FreeSlotsPool *pool);
+
+void freeslots_pool_submit(FreeSlotsPool *pool, FreeSlotsTaskGroup *group,
+                           FreeSlotsTask task, void *arg);
+
+// Returns once every task in the group has finished.
+void freeslots_pool_wait(FreeSlotsPool *pool, FreeSlotsTaskGroup *group);
+
+#endif  // POOL_H
@@ -0,0 +1,147 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "report.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *weekday_names[7] = {
+    "Monday", "Tuesday",  "Wednesday", "Thursday",
+    "Friday", "Saturday", "Sunday",
+};
+
+void report_init(Report *report) {
+    memset(report, 0, sizeof(Report));
+    report->day_lines = open_memstream(&report->day_text, &report->day_size);
+    report->week_lines =
+        open_memstream(&report->week_text, &report->week_size);
+}
+
+static int bucket_of(int minutes) {
+    int bucket = 0;
+    while (minutes > 0) {
+        bucket++;
+        minutes >>= 1;
+    }
+    return bucket;
+}
+
+// Nearest rank: the shortest length that at least `percent` of the week's
+// slots do not exceed.
+static int week_percentile(const Report *report, int percent) {
+    long rank = (report->week_slots * percent + 99) / 100;
+    long seen = 0;
+    for (int minutes = 0; minutes <= REPORT_MAX_MINUTES; minutes++) {
+        seen += report->week_lengths[minutes];
+        if (seen >= rank) return minutes;
+    }
+    return REPORT_MAX_MINUTES;
+}
+
+static void finish_day(Report *report) {
+    if (!report->has_day) return;
+
+    const FreeSlotsDate *day = &report->day;
+    fprintf(report->day_lines, "%04d-%02d-%02d   %-9ld   %d\n", day->year,
+            day->month, day->day, report->day_free, report->day_slots);
+
+    int weekday = freeslots_weekday(*day);
+    report->weekday_days[weekday]++;
+    report->weekday_free[weekday] += report->day_free;
+    report->days++;
+    report->day_free = 0;
+    report->day_slots = 0;
+    report->has_day = 0;
+}
+
+static void finish_week(Report *report) {
+    if (report->week_slots == 0) return;
+
+    fprintf(report->week_lines, "%04d-W%02d     %-8ld %-6d %d\n",
+            report->week_year, report->week, report->week_slots,
+            week_percentile(report, 50), week_percentile(report, 90));
+    memset(report->week_lengths, 0, sizeof(report->week_lengths));
+    report->week_slots = 0;
+}
+
+void report_add_day(Report *report, FreeSlotsDate date) {
+    if (report->has_day && freeslots_compare_dates(date, report->day) == 0) {
+        return;
+    }
+    finish_day(report);
+    report->day = date;
+    report->has_day = 1;
+
+    int week_year;
+    int week = freeslots_iso_week(date, &week_year);
+    if (week != report->week || week_year != report->week_year) {
+        finish_week(report);
+        report->week = week;
+        report->week_year = week_year;
+    }
+}
+
+void report_add_slot(Report *report, const FreeSlotsSlot *slot) {
+    int minutes = slot->end_minutes - slot->start_minutes;
+    if (minutes < 0) minutes = 0;
+    if (minutes > REPORT_MAX_MINUTES) minutes = REPORT_MAX_MINUTES;
+
+    report_add_day(report, slot->date);
+
+    report->day_free += minutes;
+    report->day_slots++;
+    report->week_lengths[minutes]++;
+    report->week_slots++;
+
+    int bucket = bucket_of(minutes);
+    report->buckets[bucket]++;
+    report->bucket_minutes[bucket] += minutes;
+    report->slots++;
+    report->free_minutes += minutes;
+}
+
+void report_print(Report *report, FILE *out) {
+    finish_day(report);
+    finish_week(report);
+    fclose(report->day_lines);
+    fclose(report->week_lines);
+
+    fprintf(out, "\nReport:\n");
+    fprintf(out, "Date         Free(min)   Slots\n");
+    fprintf(out, "-------------------------------\n");
+    fwrite(report->day_text, 1, report->day_size, out);
+    fprintf(out, "Total        %-9ld   %ld\n", report->free_minutes,
+            report->slots);
+
+    fprintf(out, "\nWeekday      Days     Free(min)   Average\n");
+    fprintf(out, "------------------------------------------\n");
+    for (int i = 0; i < 7; i++) {
+        long days = report->weekday_days[i];
+        fprintf(out, "%-12s %-8ld %-11ld %.1f\n", weekday_names[i], days,
+                report->weekday_free[i],
+                days > 0 ? (double)report->weekday_free[i] / days : 0.0);
+    }
+
+    fprintf(out, "\nLength(min)  Slots    Free(min)\n");
+    fprintf(out, "-------------------------------\n");
+    for (int i = 0; i < REPORT_BUCKETS; i++) {
+        char label[16];
+        int low = i == 0 ? 0 : 1 << (i - 1);
+        int high = i == 0 ? 0 : (1 << i) - 1;
+        if (high > REPORT_MAX_MINUTES) high = REPORT_MAX_MINUTES;
+        if (low == high) {
+            snprintf(label, sizeof(label), "%d", low);
+        } else {
+            snprintf(label, sizeof(label), "%d-%d", low, high);
+        }
+        fprintf(out, "%-12s %-8ld %ld\n", label, report->buckets[i],
+                report->bucket_minutes[i]);
+    }
+
+    fprintf(out, "\nWeek         Slots    p50    p90\n");
+    fprintf(out, "---------------------------------\n");
+    fwrite(report->week_text, 1, report->week_size, out);
+
+    free(report->day_text);
+    free(report->week_text);
+}
@@ -0,0 +1,57 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdio.h>
+
+#include "freeslots.h"
+
+// Utilization report behind --report, built from the slots as they are
+// printed, so its numbers are those of the listing: free minutes per day,
+// fully booked days included, and per weekday, a histogram of slot lengths in power-of-two buckets, and the
+// median and 90th percentile slot length per ISO week. Slots must arrive in
+// date order. Only the current week's lengths are counted minute by minute;
+// finished days and weeks are kept as one line of text each.
+
+#define REPORT_MAX_MINUTES (24 * 60)
+
+// Bucket 0 holds empty slots and bucket k lengths from 2^(k-1) to 2^k - 1,
+// the last one ending at a whole day.
+#define REPORT_BUCKETS 12
+
+typedef struct {
+    FreeSlotsDate day;
+    int has_day;
+    long day_free;
+    int day_slots;
+    int week;
+    int week_year;
+    long week_slots;
+    int week_lengths[REPORT_MAX_MINUTES + 1];
+
+    long weekday_days[7];
+    long weekday_free[7];
+    long buckets[REPORT_BUCKETS];
+    long bucket_minutes[REPORT_BUCKETS];
+    long days;
+    long slots;
+    long free_minutes;
+
+    FILE *day_lines;
+    char *day_text;
+    size_t day_size;
+    FILE *week_lines;
+    char *week_text;
+    size_t week_size;
+} Report;
+
+void report_init(Report *report);
+
+// Starts a day, which is listed even if no slot follows it. Days must be
+// added in date order; report_add_slot adds its slot's day itself.
+void report_add_day(Report *report, FreeSlotsDate date);
+void report_add_slot(Report *report, const FreeSlotsSlot *slot);
+
+// Prints the report and frees what it holds.
+void report_print(Report *report, FILE *out);
+
+#endif  // REPORT_H
@@ -0,0 +1,168 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static const char *phase_names[STATS_PHASE_COUNT] = {
+    "read", "parse", "load", "index", "merge+output",
+};
+
+double stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+double stats_begin_phase(Stats *stats, StatsPhase phase) {
+    if (!stats->enabled) return 0;
+
+    if (stats->perf) {
+        perf_counters_read(stats->perf, &stats->perf_started[phase]);
+    }
+    return stats_now();
+}
+
+void stats_end_phase(Stats *stats, StatsPhase phase, double started) {
+    if (!stats->enabled) return;
+
+    stats->phase_seconds[phase] += stats_now() - started;
+
+    PerfSample now;
+    if (stats->perf && perf_counters_read(stats->perf, &now)) {
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            stats->perf_phase[phase].values[i] +=
+                now.values[i] - stats->perf_started[phase].values[i];
+        }
+    }
+}
+
+static void add_skips(Stats *stats, const char *reason, long count) {
+    stats->rows_skipped += count;
+
+    // Reasons are the library's string literals, but compare the text so the
+    // counts do not depend on the linker merging them.
+    for (int i = 0; i < stats->skip_reason_count; i++) {
+        if (strcmp(stats->skips[i].reason, reason) == 0) {
+            stats->skips[i].count += count;
+            return;
+        }
+    }
+
+    if (stats->skip_reason_count < STATS_MAX_SKIP_REASONS) {
+        stats->skips[stats->skip_reason_count++] = (SkipCount){reason, count};
+    }
+}
+
+void stats_count_skip(Stats *stats, const char *reason) {
+    if (stats->enabled) {
+        add_skips(stats, reason, 1);
+    }
+}
+
+void stats_merge(Stats *into, const Stats *from) {
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        into->phase_seconds[i] += from->phase_seconds[i];
+        for (int j = 0; j < PERF_COUNTER_COUNT; j++) {
+            into->perf_phase[i].values[j] += from->perf_phase[i].values[j];
+        }
+    }
+    into->bytes_read += from->bytes_read;
+    for (int i = 0; i < from->skip_reason_count; i++) {
+        add_skips(into, from->skips[i].reason, from->skips[i].count);
+    }
+}
+
+static double per_second(double amount, double seconds) {
+    return seconds > 0 ? amount / seconds : 0;
+}
+
+static void print_counter(FILE *out, const Stats *stats, PerfCounter counter,
+                          double value, double divisor) {
+    if (!perf_counters_available(stats->perf, counter) || divisor <= 0) {
+        fprintf(out, " %11s", "n/a");
+    } else {
+        fprintf(out, " %11.3f", value / divisor);
+    }
+}
+
+static void print_perf_counters(const Stats *stats, FILE *out) {
+    int phase_count = 0;
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        phase_count += stats->phase_seconds[i] != 0;
+    }
+    if (phase_count == 0) return;
+
+    fprintf(out, "\nCounters (all threads; per event unless noted):\n");
+    fprintf(out, "  %-14s %11s %11s %11s %11s %11s %11s\n", "phase",
+            "Mcycles", "IPC", "L1D miss", "LLC miss", "br miss", "faults");
+
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        if (stats->phase_seconds[i] == 0) continue;
+
+        const double *values = stats->perf_phase[i].values;
+        fprintf(out, "  %-14s", phase_names[i]);
+        print_counter(out, stats, PERF_CYCLES, values[PERF_CYCLES], 1e6);
+        print_counter(out, stats, PERF_INSTRUCTIONS,
+                      values[PERF_INSTRUCTIONS], values[PERF_CYCLES]);
+        print_counter(out, stats, PERF_L1D_MISSES, values[PERF_L1D_MISSES],
+                      stats->events);
+        print_counter(out, stats, PERF_LLC_MISSES, values[PERF_LLC_MISSES],
+                      stats->events);
+        print_counter(out, stats, PERF_BRANCH_MISSES,
+                      values[PERF_BRANCH_MISSES], stats->events);
+        print_counter(out, stats, PERF_PAGE_FAULTS, values[PERF_PAGE_FAULTS],
+                      1);
+        fprintf(out, "\n");
+    }
+}
+
+void stats_print(const Stats *stats, FILE *out) {
+    double total = stats_now() - stats->started;
+    double parse_seconds = stats->phase_seconds[STATS_PHASE_READ] +
+                           stats->phase_seconds[STATS_PHASE_PARSE];
+    if (parse_seconds == 0) parse_seconds = total;
+    long rows_valid = stats->rows_read - stats->rows_skipped;
+
+    fprintf(out, "\nStats:\n");
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        if (stats->phase_seconds[i] == 0) continue;
+        fprintf(out, "  %-14s %10.3f ms%s\n", phase_names[i],
+                stats->phase_seconds[i] * 1e3,
+                i <= STATS_PHASE_PARSE ? "  (summed over files)" : "");
+    }
+    fprintf(out, "  %-14s %10.3f ms\n", "total", total * 1e3);
+
+    fprintf(out, "  %-14s %ld bytes, %.1f MB/s\n", "input", stats->bytes_read,
+            per_second(stats->bytes_read, parse_seconds) / 1e6);
+    fprintf(out, "  %-14s %ld (%ld skipped), %.0f rows/s\n", "rows",
+            stats->rows_read, stats->rows_skipped,
+            per_second(stats->rows_read, parse_seconds));
+    for (int i = 0; i < stats->skip_reason_count; i++) {
+        fprintf(out, "    %-24s %ld\n", stats->skips[i].reason,
+                stats->skips[i].count);
+    }
+    fprintf(out, "  %-14s %ld (%.3fx rows)\n", "events", stats->events,
+            rows_valid > 0 ? (double)stats->events / rows_valid : 0.0);
+    if (stats->days >= 0) {
+        fprintf(out, "  %-14s %ld (%.1f%% of events)\n", "duplicates",
+                stats->duplicates,
+                stats->events > 0 ? 100.0 * stats->duplicates / stats->events
+                                  : 0.0);
+        fprintf(out, "  %-14s %ld\n", "days", stats->days);
+    }
+    fprintf(out, "  %-14s %ld\n", "slots", stats->slots);
+    if (stats->isa) fprintf(out, "  %-14s %s\n", "kernels", stats->isa);
+    if (stats->loader) fprintf(out, "  %-14s %s\n", "loader", stats->loader);
+    if (stats->cache) fprintf(out, "  %-14s %s\n", "cache", stats->cache);
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        fprintf(out, "  %-14s %.1f MiB\n", "peak RSS",
+                usage.ru_maxrss / 1024.0);
+    }
+
+    if (stats->perf) print_perf_counters(stats, out);
+}
@@ -0,0 +1,71 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+#include "perf.h"
+
+// Counters and phase timings behind --stats. Everything is recorded only when
+// `enabled` is set, so a run without the flag pays for a branch per phase.
+
+#define STATS_MAX_SKIP_REASONS 16
+
+typedef enum {
+    STATS_PHASE_READ,
+    STATS_PHASE_PARSE,
+    STATS_PHASE_LOAD,
+    STATS_PHASE_INDEX,
+    STATS_PHASE_QUERY,
+    STATS_PHASE_COUNT
+} StatsPhase;
+
+typedef struct {
+    const char *reason;
+    long count;
+} SkipCount;
+
+typedef struct {
+    int enabled;
+    double started;
+    double phase_seconds[STATS_PHASE_COUNT];
+
+    long bytes_read;
+    long rows_read;
+    long rows_skipped;
+    SkipCount skips[STATS_MAX_SKIP_REASONS];
+    int skip_reason_count;
+
+    long events;
+    long duplicates;
+    long days;
+    long slots;
+
+    // Instruction set of the parsing and merging kernels, the backend that
+    // read the input files and whether the result cache was hit. An `isa`
+    // set before the run, by --force-isa, is the one the run uses.
+    const char *isa;
+    const char *loader;
+    const char *cache;
+
+    // Set by --perf-counters. The counters are inherited by the threads
+    // started after them, so every phase counts the pool's work too.
+    PerfCounters *perf;
+    PerfSample perf_started[STATS_PHASE_COUNT];
+    PerfSample perf_phase[STATS_PHASE_COUNT];
+} Stats;
+
+double stats_now(void);
+
+// Returns a timestamp to hand to stats_end_phase, or 0 when disabled.
+double stats_begin_phase(Stats *stats, StatsPhase phase);
+void stats_end_phase(Stats *stats, StatsPhase phase, double started);
+
+void stats_count_skip(Stats *stats, const char *reason);
+
+// Adds the phase times, bytes and skips of `from`, e.g. one load task's, into
+// `into`.
+void stats_merge(Stats *into, const Stats *from);
+
+void stats_print(const Stats *stats, FILE *out);
+
+#endif  // STATS_H
@@ -0,0 +1,261 @@
+// Checks the fast paths of libfreeslots against the plain code they stand in
+// for, on random inputs. The library source is included directly so its
+// static functions can be called.
+#include "../freeslots.c"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define ROUNDS 100000
+
+typedef struct {
+    const char *name;
+    int (*run)(void);
+} UnitTest;
+
+static uint64_t random_state = 1;
+
+static uint64_t next_random(void) {
+    uint64_t z = (random_state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static int random_below(int bound) {
+    return (int)(next_random() % (uint64_t)bound);
+}
+
+// Every vector instruction set, each checked against the scalar kernels when
+// the CPU supports it.
+static const char *const vector_isas[] = {"sse2", "sse4.2", "avx2",
+                                          "avx512"};
+#define VECTOR_ISA_COUNT (int)(sizeof(vector_isas) / sizeof(vector_isas[0]))
+
+// Intervals around a random window, with counts that cover every vector tail
+// and outputs both separate from and aliasing the input.
+static int check_clamp_filter(const KernelSet *scalar,
+                              const KernelSet *vector) {
+    int starts[80], ends[80], out_starts[80], out_ends[80];
+    int expected_starts[80], expected_ends[80];
+
+    for (int round = 0; round < ROUNDS; round++) {
+        int count = random_below(80);
+        int window_start = random_below(24 * 60);
+        int window_end = window_start + random_below(24 * 60 + 1);
+        for (int i = 0; i < count; i++) {
+            starts[i] = random_below(24 * 60 + 200) - 100;
+            ends[i] = starts[i] + random_below(24 * 60);
+        }
+
+        int expected =
+            scalar->clamp_filter(starts, ends, count, window_start, window_end,
+                                 expected_starts, expected_ends);
+        int aliased = round % 2;
+        int *result_starts = aliased ? starts : out_starts;
+        int *result_ends = aliased ? ends : out_ends;
+        int kept = vector->clamp_filter(starts, ends, count, window_start,
+                                        window_end, result_starts,
+                                        result_ends);
+
+        int equal = kept == expected;
+        for (int i = 0; equal && i < kept; i++) {
+            equal = result_starts[i] == expected_starts[i] &&
+                    result_ends[i] == expected_ends[i];
+        }
+        if (!equal) {
+            fprintf(stderr,
+                    "clamp_filter %s: %d intervals in %d-%d%s: kept %d, "
+                    "scalar kept %d\n",
+                    vector->isa, count, window_start, window_end,
+                    aliased ? " in place" : "", kept, expected);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Random text with a field end about every SPACING bytes, SPACING varying
+// so that ends fall in every lane and some texts have none, and with spare
+// readable bytes after it as the parser guarantees.
+static int check_field_end(const KernelSet *scalar, const KernelSet *vector) {
+    static const char ends[] = {',', '\r', '\n', '\0'};
+    char text[128];
+
+    for (int round = 0; round < ROUNDS; round++) {
+        size_t length = random_below(80);
+        int spacing = 1 + random_below(100);
+        for (size_t i = 0; i < sizeof(text); i++) {
+            text[i] = random_below(spacing) == 0 ? ends[random_below(4)]
+                                                 : '-' + random_below(13);
+        }
+
+        size_t expected = scalar->field_end(text, length);
+        size_t end = vector->field_end(text, length);
+        if (end != expected) {
+            fprintf(stderr,
+                    "field_end %s: %zu bytes '%.*s': found %zu, scalar "
+                    "found %zu\n",
+                    vector->isa, length, (int)length, text, end, expected);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Near-dates: a valid YYYY-MM-DD with one byte changed or the field cut or
+// extended now and then, so both the accepted and the rejected paths run.
+static int check_parse_date_field(const KernelSet *scalar,
+                                  const KernelSet *vector) {
+    char field[32];
+
+    for (int round = 0; round < ROUNDS; round++) {
+        memset(field, 0, sizeof(field));
+        snprintf(field, sizeof(field), "%04d-%02d-%02d", random_below(10000),
+                 random_below(14), random_below(33));
+        if (random_below(2)) {
+            field[random_below(12)] = (char)random_below(128);
+        }
+        if (random_below(8) == 0) field[10] = '0' + random_below(10);
+
+        FreeSlotsDate expected_date, date;
+        int expected = scalar->parse_date_field(field, &expected_date);
+        int parsed = vector->parse_date_field(field, &date);
+        if (parsed != expected ||
+            (parsed && freeslots_compare_dates(date, expected_date) != 0)) {
+            fprintf(stderr,
+                    "parse_date_field %s: '%s': returned %d, scalar "
+                    "returned %d\n",
+                    vector->isa, field, parsed, expected);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Years well either side of the date tables, so the civil formulas and the
+// switches between them and the tables are checked as well.
+#define CALENDAR_FIRST_YEAR 1500
+#define CALENDAR_LAST_YEAR 2600
+
+static Date naive_next_day(Date date) {
+    static const int month_days[12] = {31, 28, 31, 30, 31, 30,
+                                       31, 31, 30, 31, 30, 31};
+    int leap = date.year % 4 == 0 &&
+               (date.year % 100 != 0 || date.year % 400 == 0);
+    int last_day = month_days[date.month - 1] + (date.month == 2 && leap);
+
+    if (date.day < last_day) {
+        date.day++;
+    } else if (date.month < 12) {
+        date.month++;
+        date.day = 1;
+    } else {
+        date.year++;
+        date.month = 1;
+        date.day = 1;
+    }
+    return date;
+}
+
+// Every day from CALENDAR_FIRST_YEAR to CALENDAR_LAST_YEAR, counted one at a
+// time. Each must be one serial day after the last and map back to itself,
+// and add_days_to_date between any two must land on the later one.
+static int test_date_tables(void) {
+    int day_count = (CALENDAR_LAST_YEAR - CALENDAR_FIRST_YEAR + 1) * 366;
+    Date *days = malloc(sizeof(Date) * day_count);
+    Date date = {CALENDAR_FIRST_YEAR, 1, 1};
+    long first_serial = days_from_civil(date);
+    int count = 0;
+    int ok = 1;
+
+    while (date.year <= CALENDAR_LAST_YEAR && ok) {
+        long serial = days_from_civil(date);
+        Date back = civil_from_days(serial);
+        if (serial != first_serial + count ||
+            compare_dates(back, date) != 0) {
+            fprintf(stderr,
+                    "date tables: %04d-%02d-%02d is serial day %ld, "
+                    "expected %ld, which maps back to %04d-%02d-%02d\n",
+                    date.year, date.month, date.day, serial,
+                    first_serial + count, back.year, back.month, back.day);
+            ok = 0;
+        }
+        days[count++] = date;
+        date = naive_next_day(date);
+    }
+
+    for (int round = 0; round < ROUNDS && ok; round++) {
+        int from = random_below(count);
+        int to = random_below(4) ? from + random_below(800) - 400
+                                 : random_below(count);
+        if (to < 0 || to >= count) continue;
+
+        Date sum = add_days_to_date(days[from], to - from);
+        if (compare_dates(sum, days[to]) != 0) {
+            fprintf(stderr,
+                    "date tables: %04d-%02d-%02d plus %d days gave "
+                    "%04d-%02d-%02d, expected %04d-%02d-%02d\n",
+                    days[from].year, days[from].month, days[from].day,
+                    to - from, sum.year, sum.month, sum.day, days[to].year,
+                    days[to].month, days[to].day);
+            ok = 0;
+        }
+    }
+
+    free(days);
+    return ok;
+}
+
+static int run_kernel_check(int (*check)(const KernelSet *,
+                                         const KernelSet *)) {
+    const KernelSet *scalar = kernels_for_isa("scalar");
+    int ok = 1;
+    for (int i = 0; i < VECTOR_ISA_COUNT; i++) {
+        const KernelSet *vector = kernels_for_isa(vector_isas[i]);
+        if (!vector) {
+            printf("  %s not supported, skipped\n", vector_isas[i]);
+            continue;
+        }
+        if (!check(scalar, vector)) ok = 0;
+    }
+    return ok;
+}
+
+static int test_clamp_filter(void) {
+    return run_kernel_check(check_clamp_filter);
+}
+
+static int test_field_end(void) { return run_kernel_check(check_field_end); }
+
+static int test_parse_date_field(void) {
+    return run_kernel_check(check_parse_date_field);
+}
+
+static const UnitTest unit_tests[] = {
+    {"clamp_filter", test_clamp_filter},
+    {"field_end", test_field_end},
+    {"parse_date_field", test_parse_date_field},
+    {"date_tables", test_date_tables},
+};
+
+int main(void) {
+    int count = (int)(sizeof(unit_tests) / sizeof(unit_tests[0]));
+    int failures = 0;
+
+    for (int i = 0; i < count; i++) {
+        printf("%s\n", unit_tests[i].name);
+        fflush(stdout);
+        if (!unit_tests[i].run()) {
+            printf("  FAILED\n");
+            failures++;
+        }
+    }
+
+    if (failures > 0) {
+        printf("%d of %d unit tests failed\n", failures, count);
+        return 1;
+    }
+    printf("All %d unit tests passed\n", count);
+    return 0;
+}
@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_MAX_DEPTH 32
+
+typedef struct {
+    const char *name;
+    char *detail;
+    const char *count_name;
+    long count;
+    double start;
+    double duration;
+} TraceSpan;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;
+    int thread_id;
+    const char *thread_name;
+    TraceSpan *spans;
+    long count;
+    long capacity;
+    long open[TRACE_MAX_DEPTH];
+    int depth;
+} TraceBuffer;
+
+static int enabled;
+static double origin;
+static TraceBuffer *buffers;
+static int thread_count;
+static __thread TraceBuffer *current;
+
+static double now_microseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static TraceBuffer *thread_buffer(void) {
+    if (current) return current;
+
+    TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+    buffer->thread_id =
+        __atomic_add_fetch(&thread_count, 1, __ATOMIC_RELAXED);
+
+    buffer->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&buffers, &buffer->next, buffer, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+
+    buffer->thread_name = buffer->thread_id == 1 ? "main" : "worker";
+    current = buffer;
+    return buffer;
+}
+
+void trace_start(void) {
+    origin = now_microseconds();
+    enabled = 1;
+
+    // Registers the calling thread first, so it shows up as thread 1.
+    thread_buffer();
+}
+
+int trace_enabled(void) {
+    return enabled;
+}
+
+void trace_name_thread(const char *name) {
+    if (enabled) thread_buffer()->thread_name = name;
+}
+
+void trace_begin(const char *name, const char *detail) {
+    if (!enabled) return;
+
+    TraceBuffer *buffer = thread_buffer();
+    if (buffer->count >= buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+        buffer->spans =
+            realloc(buffer->spans, sizeof(TraceSpan) * buffer->capacity);
+    }
+
+    TraceSpan *span = &buffer->spans[buffer->count];
+    span->name = name;
+    span->detail = detail ? strdup(detail) : NULL;
+    span->count_name = NULL;
+    span->count = 0;
+    span->duration = 0;
+
+    if (buffer->depth < TRACE_MAX_DEPTH) {
+        buffer->open[buffer->depth] = buffer->count;
+    }
+    buffer->depth++;
+    buffer->count++;
+    span->start = now_microseconds() - origin;
+}
+
+void trace_end(const char *count_name, long count) {
+    if (!enabled) return;
+
+    double end = now_microseconds() - origin;
+    TraceBuffer *buffer = thread_buffer();
+    if (buffer->depth == 0) return;
+
+    buffer->depth--;
+    if (buffer->depth >= TRACE_MAX_DEPTH) return;
+
+    TraceSpan *span = &buffer->spans[buffer->open[buffer->depth]];
+    span->duration = end - span->start;
+    span->count_name = count_name;
+    span->count = count;
+}
+
+void trace_library_span(const char *name, int is_end, long count,
+                        void *user_data) {
+    (void)user_data;
+
+    if (is_end) {
+        trace_end("count", count);
+    } else {
+        trace_begin(name, NULL);
+    }
+}
+
+static void write_json_string(FILE *file, const char *str) {
+    fputc('"', file);
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+int trace_write(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot open file: %s\n", path);
+        return 0;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int first = 1;
+
+    for (TraceBuffer *buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE);
+         buffer; buffer = buffer->next) {
+        fprintf(file,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                first ? "" : ",\n", buffer->thread_id, buffer->thread_name,
+                buffer->thread_id);
+        first = 0;
+
+        for (long i = 0; i < buffer->count; i++) {
+            const TraceSpan *span = &buffer->spans[i];
+            fprintf(file, ",\n{\"name\":");
+            write_json_string(file, span->name);
+            fprintf(file,
+                    ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                    "\"dur\":%.3f,\"args\":{",
+                    buffer->thread_id, span->start, span->duration);
+
+            if (span->detail) {
+                fprintf(file, "\"detail\":");
+                write_json_string(file, span->detail);
+            }
+            if (span->count_name) {
+                fprintf(file, "%s", span->detail ? "," : "");
+                write_json_string(file, span->count_name);
+                fprintf(file, ":%ld", span->count);
+            }
+            fprintf(file, "}}");
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    int ok = !ferror(file);
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "Cannot write file: %s\n", path);
+    }
+    return ok;
+}
@@ -0,0 +1,35 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Chrome trace-event recording behind --trace. The file loads in Perfetto and
+// chrome://tracing.
+//
+// Every thread appends complete spans to its own buffer, found through a
+// thread-local pointer, so recording takes no locks. A thread links its
+// buffer into a global list with a compare-and-swap the first time it
+// records. trace_write serializes all buffers once the work is done.
+
+void trace_start(void);
+int trace_enabled(void);
+
+// Labels the calling thread in the trace; `name` must be a string literal.
+// Threads default to "main" for the one that called trace_start and
+// "worker" otherwise.
+void trace_name_thread(const char *name);
+
+// `detail`, which may be NULL, is copied and shown as the span's "detail"
+// argument.
+void trace_begin(const char *name, const char *detail);
+
+// Closes the innermost open span on this thread. A non-NULL `count_name`
+// attaches `count` as an argument.
+void trace_end(const char *count_name, long count);
+
+// FreeSlotsSpanCallback that records the library's spans.
+void trace_library_span(const char *name, int is_end, long count,
+                        void *user_data);
+
+// Writes every recorded span. Call after all traced threads are idle.
+int trace_write(const char *path);
+
+#endif  // TRACE_H